@@ -15,6 +15,7 @@
 #define PORT 8000
 #define BACKLOG 128
 #define BODY_BUF 4096
+#define LOOP_THREADS 2
 
 static bool s_exit_flag = false;
 
@@ -78,6 +79,13 @@ int main() {
     }
 
     sc_mgr_bind_hard(mgr, "/root", root_handler);
+
+    rc = sc_mgr_run_threads(mgr, LOOP_THREADS);
+    if (rc != SC_OK) {
+        fprintf(stderr, "Error starting event loop threads: %d", rc);
+        sc_mgr_finish(mgr);
+        exit(EXIT_FAILURE);
+    }
     
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
@@ -0,0 +1,269 @@
+/* End-to-end benchmark: starts a sculpt server on loopback in a child process, runs every scenario against it with
+ * the load generator, and writes the results as JSON, so that runs of two versions can be compared.
+ *
+ * usage: bench [-d seconds] [-w warmup seconds] [-l server loops] [-t client threads] [-c max connections]
+ *              [-p port] [-f name filter] [-o output file] [-u (io_uring backend)] */
+
+#include "../src/sculpt.h"
+#include "load.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+
+#define BENCH_PORT 8089
+#define BENCH_BACKLOG 4096
+#define BENCH_LARGE_SIZE 65536
+
+struct scenario {
+    const char *name;
+    const char *method;
+    const char *path;
+    size_t body_size;
+    bool keep_alive;
+    int connections;
+};
+
+/* /small is a hard route and /soft/ a soft one, with the same handler, so they only differ by the lookup;
+ * /missing gets the 404 the server sends on its own */
+static const struct scenario scenarios[] = {
+    {"small-keepalive-c1", "GET", "/small", 0, true, 1},
+    {"small-keepalive-c64", "GET", "/small", 0, true, 64},
+    {"small-keepalive-c1024", "GET", "/small", 0, true, 1024},
+    {"small-keepalive-c10000", "GET", "/small", 0, true, 10000},
+    {"small-close-c1", "GET", "/small", 0, false, 1},
+    {"small-close-c64", "GET", "/small", 0, false, 64},
+    {"small-close-c1024", "GET", "/small", 0, false, 1024},
+    {"large-keepalive-c64", "GET", "/large", 0, true, 64},
+    {"large-close-c64", "GET", "/large", 0, false, 64},
+    {"upload-16k-keepalive-c64", "POST", "/upload", 16384, true, 64},
+    {"soft-route-keepalive-c64", "GET", "/soft/items/42", 0, true, 64},
+    {"not-found-keepalive-c64", "GET", "/missing", 0, true, 64},
+};
+
+// bound next to the benchmarked ones, so the routes are looked up in a tree of a realistic size
+static const char *const filler_routes[] = {
+    "/api/users", "/api/orders", "/api/products", "/api/carts", "/api/sessions", "/api/search",
+    "/sm", "/smaller", "/large/x", "/status", "/health", "/login", "/logout", "/static/x",
+};
+
+static char large_body[BENCH_LARGE_SIZE];
+static volatile sig_atomic_t s_exit_flag = 0;
+
+static void signal_handler(int sig) {
+    (void) sig;
+    s_exit_flag = 1;
+}
+
+static void small_handler(int fd, sc_http_msg msg, sc_headers *headers) {
+    (void) msg;
+    (void) headers;
+    sc_easy_send(fd, 200, "OK", "Content-Type: text/plain", "Hello, world!\n", NULL);
+}
+
+static void large_handler(int fd, sc_http_msg msg, sc_headers *headers) {
+    (void) msg;
+    (void) headers;
+    sc_easy_send_n(fd, 200, "OK", "Content-Type: application/octet-stream", large_body, sizeof(large_body), NULL);
+}
+
+static void upload_handler(int fd, sc_http_msg msg, sc_headers *headers, sc_str chunk) {
+    (void) msg;
+    (void) headers;
+    if (chunk.buf == NULL || chunk.len > 0) return;
+    sc_easy_send(fd, 200, "OK", "Content-Type: text/plain", "stored\n", NULL);
+}
+
+// runs in the child process until SIGTERM, writes a byte to ready once it accepts connections
+static int server_run(int port, int loops, int max_conns, int backend, int ready) {
+    signal(SIGINT, SIG_IGN);
+    signal(SIGTERM, signal_handler);
+    memset(large_body, 'x', sizeof(large_body));
+
+    int err;
+    sc_conn_mgr *mgr = sc_mgr_create(sc_addr_create(AF_INET, port), &err);
+    if (mgr == NULL) {
+        fprintf(stderr, "bench: error creating the server: %d\n", err);
+        return 1;
+    }
+    sc_mgr_ll_set(mgr, SC_LL_NONE);
+    sc_mgr_backlog_set(mgr, BENCH_BACKLOG);
+
+    int rc = sc_mgr_backend_set(mgr, backend);
+    if (rc == SC_OK) rc = sc_mgr_epoll_init(mgr);
+    if (rc == SC_OK) rc = sc_mgr_conn_pool_init(mgr, max_conns);
+    if (rc == SC_OK) rc = sc_mgr_listen(mgr);
+    for (size_t i = 0; rc == SC_OK && i < sizeof(filler_routes) / sizeof(filler_routes[0]); i++) {
+        rc = sc_mgr_bind_hard(mgr, filler_routes[i], small_handler);
+    }
+    if (rc == SC_OK) rc = sc_mgr_bind_hard(mgr, "/small", small_handler);
+    if (rc == SC_OK) rc = sc_mgr_bind_hard(mgr, "/large", large_handler);
+    if (rc == SC_OK) rc = sc_mgr_bind_soft(mgr, "/soft/", small_handler);
+    if (rc == SC_OK) rc = sc_mgr_bind_body_hard(mgr, "/upload", upload_handler);
+    if (rc == SC_OK) rc = sc_mgr_run_threads(mgr, loops);
+    if (rc != SC_OK) {
+        fprintf(stderr, "bench: error starting the server: %d\n", rc);
+        sc_mgr_finish(mgr);
+        return 1;
+    }
+
+    char byte = 1;
+    if (write(ready, &byte, 1) != 1) {
+        sc_mgr_finish(mgr);
+        return 1;
+    }
+    close(ready);
+
+    while (!s_exit_flag) {
+        sc_mgr_poll(mgr, 100);
+    }
+    sc_mgr_finish(mgr);
+    return 0;
+}
+
+static pid_t server_start(int port, int loops, int max_conns, int backend) {
+    int fds[2];
+    if (pipe(fds) == -1) return -1;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        _exit(server_run(port, loops, max_conns, backend, fds[1]));
+    }
+    close(fds[1]);
+
+    char byte;
+    if (pid == -1 || read(fds[0], &byte, 1) != 1) {
+        if (pid > 0) {
+            waitpid(pid, NULL, 0);
+        }
+        close(fds[0]);
+        return -1;
+    }
+    close(fds[0]);
+    return pid;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-d seconds] [-w warmup seconds] [-l server loops] [-t client threads] "
+            "[-c max connections] [-p port] [-f name filter] [-o output file] [-u]\n", name);
+}
+
+int main(int argc, char **argv) {
+    int cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    double duration = 2;
+    double warmup = 0.5;
+    int loops = cpus;
+    int threads = cpus;
+    int max_connections = 10000;
+    int port = BENCH_PORT;
+    const char *filter = NULL;
+    const char *output = NULL;
+    int backend = SC_BACKEND_EPOLL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:w:l:t:c:p:f:o:u")) != -1) {
+        switch (opt) {
+            case 'd': duration = atof(optarg); break;
+            case 'w': warmup = atof(optarg); break;
+            case 'l': loops = atoi(optarg); break;
+            case 't': threads = atoi(optarg); break;
+            case 'c': max_connections = atoi(optarg); break;
+            case 'p': port = atoi(optarg); break;
+            case 'f': filter = optarg; break;
+            case 'o': output = optarg; break;
+            case 'u': backend = SC_BACKEND_IO_URING; break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (loops < 1 || threads < 1 || duration <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    FILE *out = stdout;
+    if (output != NULL && (out = fopen(output, "w")) == NULL) {
+        perror(output);
+        return 1;
+    }
+
+#ifndef __OPTIMIZE__
+    fprintf(stderr, "bench: built without optimizations, configure with -DCMAKE_BUILD_TYPE=Release\n");
+#endif
+
+    // the child inherits it, both ends of every connection are in this machine
+    load_fd_limit_raise();
+
+    // every loop gets its slice of the pool, which must hold the largest scenario on any of them
+    pid_t server = server_start(port, loops, (max_connections + 64) * loops, backend);
+    if (server == -1) {
+        fprintf(stderr, "bench: couldn't start the server\n");
+        return 1;
+    }
+
+    load_result *result = malloc(sizeof(*result));
+    if (result == NULL) {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+        return 1;
+    }
+
+    char date[32];
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    fprintf(out, "{\"date\": \"%s\", \"cpus\": %d, \"server_loops\": %d, \"backend\": \"%s\", \"client_threads\": %d, "
+            "\"scenarios\": [", date, cpus, loops, backend == SC_BACKEND_IO_URING ? "io_uring" : "epoll", threads);
+
+    int rc = 0;
+    bool first = true;
+    fprintf(stderr, "%-28s %12s %10s %10s %10s %8s\n", "scenario", "req/s", "p50 us", "p99 us", "p99.9 us", "errors");
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        const struct scenario *s = &scenarios[i];
+        if (filter != NULL && strstr(s->name, filter) == NULL) continue;
+        if (s->connections > max_connections) continue;
+
+        load_config config = {
+            .host = "127.0.0.1",
+            .port = port,
+            .method = s->method,
+            .path = s->path,
+            .body_size = s->body_size,
+            .keep_alive = s->keep_alive,
+            .connections = s->connections,
+            .threads = threads,
+            .duration = duration,
+            .warmup = warmup,
+        };
+        if (load_run(&config, result) != 0) {
+            fprintf(stderr, "%-28s couldn't be started\n", s->name);
+            rc = 1;
+            continue;
+        }
+
+        fprintf(stderr, "%-28s %12.0f %10.1f %10.1f %10.1f %8llu\n", s->name, result->requests / result->elapsed,
+                load_percentile(result, 0.5) / 1e3, load_percentile(result, 0.99) / 1e3,
+                load_percentile(result, 0.999) / 1e3, (unsigned long long) result->errors);
+        fprintf(out, "%s\n  ", first ? "" : ",");
+        load_print_json(out, s->name, &config, result);
+        first = false;
+    }
+    fprintf(out, "\n]}\n");
+
+    free(result);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    kill(server, SIGTERM);
+    int status;
+    waitpid(server, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "bench: the server didn't exit cleanly\n");
+        rc = 1;
+    }
+    return rc;
+}
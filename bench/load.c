@@ -0,0 +1,400 @@
+#include "load.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#define LOAD_HEAD_SIZE 2048         // largest response head accepted
+#define LOAD_SCRATCH_SIZE 65536     // response bodies are read here and thrown away
+#define LOAD_MAX_EVENTS 256
+
+enum {
+    CONN_WRITING,       // connecting, or sending the request
+    CONN_READING_HEAD,
+    CONN_READING_BODY,
+};
+
+struct load_conn {
+    int fd;
+    int state;
+    size_t sent;
+    uint64_t start_ns;      // when the request was started, or the connection opened in close mode
+    uint64_t body_left;
+    int status;
+    size_t head_len;
+    char head[LOAD_HEAD_SIZE];
+};
+
+struct load_thread {
+    const load_config *config;
+    const char *request;
+    size_t request_len;
+    struct sockaddr_in addr;
+    int epfd;
+    int count;
+    struct load_conn *conns;
+    uint64_t measure_ns;    // responses are counted from here
+    uint64_t end_ns;
+    load_result result;
+    char scratch[LOAD_SCRATCH_SIZE];
+    pthread_t thread;
+};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int bucket_index(uint64_t ns) {
+    if (ns < LOAD_SUB_COUNT) return (int) ns;
+
+    int h = 63 - __builtin_clzll(ns);
+    int sub = (int) (ns >> (h - LOAD_SUB_BITS)) & (LOAD_SUB_COUNT - 1);
+    return (h - LOAD_SUB_BITS + 1) * LOAD_SUB_COUNT + sub;
+}
+
+static uint64_t bucket_upper(int index) {
+    if (index < LOAD_SUB_COUNT) return index;
+
+    int h = index / LOAD_SUB_COUNT + LOAD_SUB_BITS - 1;
+    uint64_t sub = index % LOAD_SUB_COUNT;
+    return ((LOAD_SUB_COUNT + sub + 1) << (h - LOAD_SUB_BITS)) - 1;
+}
+
+uint64_t load_percentile(const load_result *result, double q) {
+    if (result->requests == 0) return 0;
+
+    uint64_t rank = (uint64_t) (q * result->requests + 0.5);
+    if (rank == 0) rank = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < LOAD_BUCKETS; i++) {
+        seen += result->buckets[i];
+        if (seen >= rank) {
+            uint64_t upper = bucket_upper(i);
+            return upper < result->max_ns ? upper : result->max_ns;
+        }
+    }
+    return result->max_ns;
+}
+
+void load_fd_limit_raise(void) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
+
+void load_print_json(FILE *out, const char *name, const load_config *config, const load_result *result) {
+    double seconds = result->elapsed > 0 ? result->elapsed : 1;
+    fprintf(out, "{");
+    if (name != NULL) {
+        fprintf(out, "\"name\": \"%s\", ", name);
+    }
+    fprintf(out, "\"method\": \"%s\", \"path\": \"%s\", \"body_bytes\": %zu, \"keep_alive\": %s, "
+            "\"connections\": %d, \"threads\": %d, \"duration_s\": %.3f, ",
+            config->method, config->path, config->body_size, config->keep_alive ? "true" : "false",
+            config->connections, config->threads, result->elapsed);
+    fprintf(out, "\"requests\": %llu, \"non_2xx\": %llu, \"errors\": %llu, \"rps\": %.1f, \"mb_per_s\": %.2f, ",
+            (unsigned long long) result->requests, (unsigned long long) result->non_2xx,
+            (unsigned long long) result->errors, result->requests / seconds, result->bytes / seconds / 1e6);
+    fprintf(out, "\"latency_us\": {\"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}}",
+            load_percentile(result, 0.5) / 1e3, load_percentile(result, 0.99) / 1e3,
+            load_percentile(result, 0.999) / 1e3, result->max_ns / 1e3);
+}
+
+static bool measuring(struct load_thread *t, uint64_t now) {
+    return now >= t->measure_ns && now < t->end_ns;
+}
+
+static void conn_open(struct load_thread *t, struct load_conn *c) {
+    c->state = CONN_WRITING;
+    c->sent = 0;
+    c->head_len = 0;
+    c->start_ns = now_ns();
+
+    c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd == -1) return;
+
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (!t->config->keep_alive) {
+        // closing with a reset leaves no TIME_WAIT behind, or the local ports would run out within seconds
+        struct linger linger = {1, 0};
+        setsockopt(c->fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+    }
+
+    if (connect(c->fd, (struct sockaddr *) &t->addr, sizeof(t->addr)) == -1 && errno != EINPROGRESS) {
+        close(c->fd);
+        c->fd = -1;
+        return;
+    }
+
+    // edge-triggered for both directions, the connection is driven by its state and never re-registered
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLET, .data.ptr = c};
+    if (epoll_ctl(t->epfd, EPOLL_CTL_ADD, c->fd, &ev) == -1) {
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+static void conn_reopen(struct load_thread *t, struct load_conn *c) {
+    if (c->fd != -1) {
+        close(c->fd);
+    }
+    conn_open(t, c);
+}
+
+static void conn_fail(struct load_thread *t, struct load_conn *c) {
+    if (measuring(t, now_ns())) {
+        t->result.errors++;
+    }
+    conn_reopen(t, c);
+}
+
+// reads the status and Content-Length out of a complete response head
+static bool head_parse(struct load_conn *c, size_t head_end) {
+    c->head[head_end - 1] = '\0';
+    if (strncmp(c->head, "HTTP/1.", 7) != 0 || head_end < 12) return false;
+    c->status = atoi(c->head + 9);
+
+    const char *line = strstr(c->head, "\r\n");
+    while (line != NULL && line[2] != '\r') {
+        line += 2;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            c->body_left = strtoull(line + 15, NULL, 10);
+            return true;
+        }
+        line = strstr(line, "\r\n");
+    }
+    // every response sculpt sends on its own has a length, chunked streams aren't benchmarked
+    return false;
+}
+
+static void response_done(struct load_thread *t, struct load_conn *c) {
+    uint64_t now = now_ns();
+    if (measuring(t, now)) {
+        uint64_t ns = now - c->start_ns;
+        t->result.requests++;
+        t->result.buckets[bucket_index(ns)]++;
+        if (ns > t->result.max_ns) {
+            t->result.max_ns = ns;
+        }
+        if (c->status < 200 || c->status > 299) {
+            t->result.non_2xx++;
+        }
+    }
+
+    if (t->config->keep_alive) {
+        c->state = CONN_WRITING;
+        c->sent = 0;
+        c->head_len = 0;
+        c->start_ns = now;
+    } else {
+        conn_reopen(t, c);
+    }
+}
+
+// moves the connection along until it would block. Returns false once it was replaced by a new one
+static bool conn_step(struct load_thread *t, struct load_conn *c) {
+    for (;;) {
+        if (c->state == CONN_WRITING) {
+            ssize_t n = send(c->fd, t->request + c->sent, t->request_len - c->sent, MSG_NOSIGNAL);
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EINTR) return true;
+                conn_fail(t, c);
+                return false;
+            }
+            c->sent += n;
+            if (c->sent < t->request_len) continue;
+            c->state = CONN_READING_HEAD;
+        }
+
+        if (c->state == CONN_READING_HEAD) {
+            ssize_t n = read(c->fd, c->head + c->head_len, sizeof(c->head) - c->head_len - 1);
+            if (n == -1 && (errno == EAGAIN || errno == EINTR)) return true;
+            if (n <= 0) {
+                conn_fail(t, c);
+                return false;
+            }
+            c->head_len += n;
+            if (measuring(t, now_ns())) {
+                t->result.bytes += n;
+            }
+
+            c->head[c->head_len] = '\0';
+            const char *end = strstr(c->head, "\r\n\r\n");
+            if (end == NULL) {
+                if (c->head_len == sizeof(c->head) - 1) {
+                    conn_fail(t, c);
+                    return false;
+                }
+                continue;
+            }
+
+            size_t head_end = end - c->head + 4;
+            size_t extra = c->head_len - head_end;
+            if (!head_parse(c, head_end) || extra > c->body_left) {
+                conn_fail(t, c);
+                return false;
+            }
+            c->body_left -= extra;
+            c->state = CONN_READING_BODY;
+        }
+
+        if (c->state == CONN_READING_BODY) {
+            while (c->body_left > 0) {
+                size_t want = c->body_left < sizeof(t->scratch) ? c->body_left : sizeof(t->scratch);
+                ssize_t n = read(c->fd, t->scratch, want);
+                if (n == -1 && (errno == EAGAIN || errno == EINTR)) return true;
+                if (n <= 0) {
+                    conn_fail(t, c);
+                    return false;
+                }
+                c->body_left -= n;
+                if (measuring(t, now_ns())) {
+                    t->result.bytes += n;
+                }
+            }
+
+            response_done(t, c);
+            if (!t->config->keep_alive) return false;
+        }
+    }
+}
+
+static void *load_thread_run(void *arg) {
+    struct load_thread *t = arg;
+    struct epoll_event events[LOAD_MAX_EVENTS];
+
+    for (int i = 0; i < t->count; i++) {
+        conn_open(t, &t->conns[i]);
+    }
+
+    uint64_t now;
+    while ((now = now_ns()) < t->end_ns) {
+        int n = epoll_wait(t->epfd, events, LOAD_MAX_EVENTS, 10);
+        for (int i = 0; i < n; i++) {
+            struct load_conn *c = events[i].data.ptr;
+            conn_step(t, c);
+        }
+
+        // connections whose socket couldn't be created are retried here
+        for (int i = 0; i < t->count && n <= 0; i++) {
+            if (t->conns[i].fd == -1) {
+                conn_fail(t, &t->conns[i]);
+            }
+        }
+    }
+
+    for (int i = 0; i < t->count; i++) {
+        if (t->conns[i].fd != -1) {
+            close(t->conns[i].fd);
+        }
+    }
+    return NULL;
+}
+
+static char *request_build(const load_config *config, size_t *len) {
+    char head[1024];
+    int head_len = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\nHost: %s:%d\r\nUser-Agent: sc_load\r\n%s",
+                            config->method, config->path, config->host, config->port,
+                            config->keep_alive ? "" : "Connection: close\r\n");
+    if (config->body_size > 0) {
+        head_len += snprintf(head + head_len, sizeof(head) - head_len, "Content-Length: %zu\r\n", config->body_size);
+    }
+    head_len += snprintf(head + head_len, sizeof(head) - head_len, "\r\n");
+    if (head_len >= (int) sizeof(head)) return NULL;
+
+    char *request = malloc(head_len + config->body_size);
+    if (request == NULL) return NULL;
+    memcpy(request, head, head_len);
+    memset(request + head_len, 'x', config->body_size);
+    *len = head_len + config->body_size;
+    return request;
+}
+
+int load_run(const load_config *config, load_result *result) {
+    memset(result, 0, sizeof(*result));
+    if (config->connections < 1 || config->threads < 1) return -1;
+
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(config->port)};
+    if (inet_pton(AF_INET, config->host, &addr.sin_addr) != 1) return -1;
+
+    size_t request_len;
+    char *request = request_build(config, &request_len);
+    if (request == NULL) return -1;
+
+    int threads = config->threads < config->connections ? config->threads : config->connections;
+    struct load_thread *ts = calloc(threads, sizeof(*ts));
+    struct load_conn *conns = calloc(config->connections, sizeof(*conns));
+    if (ts == NULL || conns == NULL) {
+        free(ts);
+        free(conns);
+        free(request);
+        return -1;
+    }
+
+    uint64_t start = now_ns();
+    uint64_t measure = start + (uint64_t) (config->warmup * 1e9);
+    uint64_t end = measure + (uint64_t) (config->duration * 1e9);
+
+    int started = 0;
+    struct load_conn *next = conns;
+    for (int i = 0; i < threads; i++) {
+        struct load_thread *t = &ts[i];
+        t->config = config;
+        t->request = request;
+        t->request_len = request_len;
+        t->addr = addr;
+        t->count = config->connections / threads + (i < config->connections % threads);
+        t->conns = next;
+        t->measure_ns = measure;
+        t->end_ns = end;
+        next += t->count;
+
+        t->epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (t->epfd == -1) break;
+        if (pthread_create(&t->thread, NULL, load_thread_run, t) != 0) {
+            close(t->epfd);
+            break;
+        }
+        started++;
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(ts[i].thread, NULL);
+        close(ts[i].epfd);
+
+        load_result *r = &ts[i].result;
+        result->requests += r->requests;
+        result->non_2xx += r->non_2xx;
+        result->errors += r->errors;
+        result->bytes += r->bytes;
+        if (r->max_ns > result->max_ns) {
+            result->max_ns = r->max_ns;
+        }
+        for (int j = 0; j < LOAD_BUCKETS; j++) {
+            result->buckets[j] += r->buckets[j];
+        }
+    }
+    result->elapsed = config->duration;
+
+    free(ts);
+    free(conns);
+    free(request);
+    return started == threads ? 0 : -1;
+}
@@ -0,0 +1,52 @@
+/* epoll based HTTP/1.1 load generator used by the bench driver and sc_load. Every thread keeps its share of the
+ * connections busy with one request at a time and records how long each response took to arrive. */
+
+#ifndef SC_BENCH_LOAD_H
+#define SC_BENCH_LOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// latencies are kept in ns, in log-linear buckets of 2^LOAD_SUB_BITS per power of two (under 1.6% wide)
+#define LOAD_SUB_BITS 6
+#define LOAD_SUB_COUNT (1 << LOAD_SUB_BITS)
+#define LOAD_BUCKETS ((64 - LOAD_SUB_BITS + 1) * LOAD_SUB_COUNT)
+
+typedef struct {
+    const char *host;       // IPv4 address
+    int port;
+    const char *method;
+    const char *path;
+    size_t body_size;       // bytes of request body, sent with a Content-Length
+    bool keep_alive;        // false sends Connection: close and opens a new connection per request
+    int connections;
+    int threads;
+    double duration;        // seconds
+    double warmup;          // seconds of load not counted in the results
+} load_config;
+
+typedef struct {
+    uint64_t requests;      // complete responses
+    uint64_t non_2xx;       // of those, with a status outside of 200-299
+    uint64_t errors;        // failed connects, resets, and connections closed before a full response
+    uint64_t bytes;         // response bytes read
+    double elapsed;         // seconds measured
+    uint64_t max_ns;
+    uint64_t buckets[LOAD_BUCKETS];
+} load_result;
+
+/* Runs the load described by config and fills result. Returns 0, or -1 if it couldn't be started */
+int load_run(const load_config *config, load_result *result);
+
+/* raises the open files limit as far as allowed, each connection takes one */
+void load_fd_limit_raise(void);
+
+/* latency under which a fraction q of the responses arrived, in ns */
+uint64_t load_percentile(const load_result *result, double q);
+
+/* prints the config and result as one JSON object, without a line end. name is added first if not NULL */
+void load_print_json(FILE *out, const char *name, const load_config *config, const load_result *result);
+
+#endif
@@ -0,0 +1,421 @@
+/* Microbenchmarks of the request parser, the router, the response and header builders and the string helpers.
+ * Each case runs in a loop for a while and reports the time and the malloc()/calloc()/realloc() calls per operation;
+ * the allocations are counted by linking with -Wl,--wrap for each of them, so only the ones made by sculpt itself
+ * show up. The parser cases run on the requests recorded in bench/corpus, one case per file.
+ *
+ * usage: microbench [-c corpus dir] [-t seconds per case] [-f name filter] [-j (JSON output)] */
+
+#include "../src/sculpt.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+
+#ifndef SC_CORPUS_DIR
+#define SC_CORPUS_DIR "bench/corpus"
+#endif
+
+#define CORPUS_MAX_SIZE SC_CONN_READ_BUF_SIZE
+
+// allocation counting
+
+static uint64_t s_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    s_allocs++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    s_allocs++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    s_allocs++;
+    return __real_realloc(ptr, size);
+}
+
+// results are added here, so the compiler can't drop the calls
+static volatile uint64_t s_sink;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+// recorded requests
+
+struct request {
+    char name[64];
+    char data[CORPUS_MAX_SIZE];
+    size_t len;
+    size_t line_len;    // request line, without its line end
+};
+
+static struct request *s_requests;
+static int s_request_count;
+
+// the files are kept with plain line ends to be easy to edit, the head gets its CRLFs back here
+static bool request_load(const char *path, struct request *req) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) return false;
+
+    char raw[CORPUS_MAX_SIZE];
+    size_t raw_len = fread(raw, 1, sizeof(raw), file);
+    fclose(file);
+
+    bool head = true;
+    req->len = 0;
+    for (size_t i = 0; i < raw_len && req->len < sizeof(req->data) - 2; i++) {
+        if (head && raw[i] == '\n' && (i == 0 || raw[i - 1] != '\r')) {
+            req->data[req->len++] = '\r';
+        }
+        req->data[req->len++] = raw[i];
+        // the empty line ends the head, the body is left as it is
+        if (head && req->len >= 4 && memcmp(req->data + req->len - 4, "\r\n\r\n", 4) == 0) {
+            head = false;
+        }
+    }
+
+    req->line_len = strcspn(req->data, "\r");
+    return req->len > 0 && !head;
+}
+
+static int corpus_filter(const struct dirent *entry) {
+    size_t len = strlen(entry->d_name);
+    return len > 5 && strcmp(entry->d_name + len - 5, ".http") == 0;
+}
+
+static int corpus_load(const char *dir) {
+    struct dirent **entries;
+    int count = scandir(dir, &entries, corpus_filter, alphasort);
+    if (count <= 0) {
+        fprintf(stderr, "microbench: no .http files in %s\n", dir);
+        return -1;
+    }
+
+    s_requests = calloc(count, sizeof(struct request));
+    int rc = s_requests != NULL ? 0 : -1;
+    for (int i = 0; i < count; i++) {
+        if (rc == 0) {
+            struct request *req = &s_requests[s_request_count];
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", dir, entries[i]->d_name);
+            snprintf(req->name, sizeof(req->name), "%.*s", (int) strlen(entries[i]->d_name) - 5, entries[i]->d_name);
+            if (request_load(path, req)) {
+                s_request_count++;
+            } else {
+                fprintf(stderr, "microbench: %s is not a complete request\n", path);
+                rc = -1;
+            }
+        }
+        free(entries[i]);
+    }
+    free(entries);
+    return rc;
+}
+
+// cases
+
+struct parse_ctx {
+    const struct request *req;
+    sc_conn conn;
+    int sv[2];          // socketpair the request goes through first, for the recv cases
+};
+
+static int parse_once(struct parse_ctx *ctx) {
+    _sc_arena_reset(&ctx->conn.arena);
+    _sc_parser_reset(&ctx->conn);
+    int rc = _sc_request_parse(&ctx->conn, SIZE_MAX);
+    s_sink += rc + ctx->conn.parser.header_count;
+    return rc;
+}
+
+// the parser splits the buffer in place, so the request is copied in again every time, like a read would
+static void bench_parse(void *arg, uint64_t iters) {
+    struct parse_ctx *ctx = arg;
+    for (uint64_t i = 0; i < iters; i++) {
+        memcpy(ctx->conn.rbuf, ctx->req->data, ctx->req->len);
+        ctx->conn.rbuf_len = ctx->req->len;
+        parse_once(ctx);
+    }
+}
+
+static void bench_recv_parse(void *arg, uint64_t iters) {
+    struct parse_ctx *ctx = arg;
+    for (uint64_t i = 0; i < iters; i++) {
+        if (write(ctx->sv[0], ctx->req->data, ctx->req->len) != (ssize_t) ctx->req->len) return;
+        ssize_t n = read(ctx->sv[1], ctx->conn.rbuf, ctx->conn.rbuf_cap);
+        if (n <= 0) return;
+        ctx->conn.rbuf_len = n;
+        parse_once(ctx);
+    }
+}
+
+static void bench_request_line(void *arg, uint64_t iters) {
+    const struct request *req = ((struct parse_ctx *) arg)->req;
+    char line[CORPUS_MAX_SIZE];
+    sc_http_msg msg;
+    for (uint64_t i = 0; i < iters; i++) {
+        memcpy(line, req->data, req->line_len + 1);
+        int rc = get_http_msg(line, req->line_len, &msg);
+        s_sink += rc + msg.uri.len;
+    }
+}
+
+// the same endpoints as the bench server binds, and some soft ones
+static const char *const hard_routes[] = {
+    "/api/users", "/api/orders", "/api/products", "/api/carts", "/api/sessions", "/api/search",
+    "/sm", "/small", "/smaller", "/large", "/large/x", "/status", "/health", "/login", "/logout", "/static/x",
+    "/upload",
+};
+static const char *const soft_routes[] = {"/soft/", "/static/", "/api/v2/", "/api/users/"};
+
+#define ROUTE_COUNT (sizeof(hard_routes) / sizeof(hard_routes[0]) + sizeof(soft_routes) / sizeof(soft_routes[0]))
+
+struct route_ctx {
+    struct _endpoint_list endpoints[ROUTE_COUNT];
+    struct _route_node *root;
+    sc_str uris[4];
+};
+
+static void bench_route(void *arg, uint64_t iters) {
+    struct route_ctx *ctx = arg;
+    for (uint64_t i = 0; i < iters; i++) {
+        struct _endpoint_list *endpoint = _sc_route_find(ctx->root, ctx->uris[i & 3]);
+        s_sink += endpoint != NULL;
+    }
+}
+
+struct build_ctx {
+    sc_headers *headers;
+    const char *body;
+};
+
+static void bench_request_build(void *arg, uint64_t iters) {
+    struct build_ctx *ctx = arg;
+    for (uint64_t i = 0; i < iters; i++) {
+        char *response = sc_easy_request_build(200, "OK", ctx->body, ctx->headers);
+        s_sink += response != NULL;
+        free(response);
+    }
+}
+
+static const char *const append_headers[] = {
+    "Content-Type: application/json", "Cache-Control: no-store", "X-Request-Id: 0b6e4f7a-2d1c-4e9b",
+    "Set-Cookie: session=7f3a9c2e4b1d8f60; HttpOnly", "Vary: Accept-Encoding", "Server: sculpt",
+    "Access-Control-Allow-Origin: *", "X-Frame-Options: DENY",
+};
+
+static void bench_header_append(void *arg, uint64_t iters) {
+    (void) arg;
+    for (uint64_t i = 0; i < iters; i++) {
+        sc_headers *list = NULL;
+        for (size_t j = 0; j < sizeof(append_headers) / sizeof(append_headers[0]); j++) {
+            list = sc_header_append(append_headers[j], list);
+        }
+        s_sink += list != NULL;
+        sc_headers_free(list);
+    }
+}
+
+struct str_ctx {
+    sc_str a;
+    sc_str b;
+};
+
+static void bench_strcmp(void *arg, uint64_t iters) {
+    struct str_ctx *ctx = arg;
+    for (uint64_t i = 0; i < iters; i++) {
+        s_sink += sc_strcmp(ctx->a, ctx->b);
+    }
+}
+
+static void bench_strprefix(void *arg, uint64_t iters) {
+    struct str_ctx *ctx = arg;
+    for (uint64_t i = 0; i < iters; i++) {
+        s_sink += sc_strprefix(ctx->a, ctx->b);
+    }
+}
+
+// runner
+
+static double s_case_time = 0.3;
+static const char *s_filter;
+static bool s_json;
+static bool s_first = true;
+
+static void run_case(const char *name, void (*run)(void *, uint64_t), void *ctx) {
+    if (s_filter != NULL && strstr(name, s_filter) == NULL) return;
+
+    // once before timing, so buffers kept between operations are already there
+    run(ctx, 1);
+
+    // doubled until it takes a tenth of the time, then run once more for the whole of it
+    uint64_t target = (uint64_t) (s_case_time * 1e9);
+    uint64_t iters = 1;
+    uint64_t elapsed;
+    do {
+        iters *= 2;
+        uint64_t start = now_ns();
+        run(ctx, iters);
+        elapsed = now_ns() - start;
+    } while (elapsed < target / 10);
+
+    iters = iters * target / elapsed + 1;
+    uint64_t start_allocs = s_allocs;
+    uint64_t start = now_ns();
+    run(ctx, iters);
+    elapsed = now_ns() - start;
+    uint64_t allocs = s_allocs - start_allocs;
+
+    double ns = (double) elapsed / iters;
+    double per_op = (double) allocs / iters;
+    if (s_json) {
+        printf("%s\n  {\"name\": \"%s\", \"ns_per_op\": %.2f, \"allocs_per_op\": %.2f, \"ops\": %llu}",
+               s_first ? "" : ",", name, ns, per_op, (unsigned long long) iters);
+    } else {
+        printf("%-36s %10.1f ns/op %8.2f allocs/op %12llu ops\n", name, ns, per_op, (unsigned long long) iters);
+    }
+    s_first = false;
+}
+
+static void run_parse_cases(void) {
+    struct parse_ctx ctx = {0};
+    ctx.conn.rbuf = malloc(SC_CONN_READ_BUF_SIZE);
+    ctx.conn.rbuf_cap = SC_CONN_READ_BUF_SIZE;
+    if (ctx.conn.rbuf == NULL || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, ctx.sv) == -1) {
+        free(ctx.conn.rbuf);
+        return;
+    }
+
+    char name[128];
+    for (int i = 0; i < s_request_count; i++) {
+        ctx.req = &s_requests[i];
+
+        // a request the parser refuses would only measure how fast it gives up
+        memcpy(ctx.conn.rbuf, ctx.req->data, ctx.req->len);
+        ctx.conn.rbuf_len = ctx.req->len;
+        if (parse_once(&ctx) != SC_OK) {
+            fprintf(stderr, "microbench: %s doesn't parse, skipped\n", ctx.req->name);
+            continue;
+        }
+
+        snprintf(name, sizeof(name), "request_parse/%s", ctx.req->name);
+        run_case(name, bench_parse, &ctx);
+        snprintf(name, sizeof(name), "recv+request_parse/%s", ctx.req->name);
+        run_case(name, bench_recv_parse, &ctx);
+        snprintf(name, sizeof(name), "get_http_msg/%s", ctx.req->name);
+        run_case(name, bench_request_line, &ctx);
+    }
+
+    _sc_arena_free(&ctx.conn.arena);
+    free(ctx.conn.rbuf);
+    close(ctx.sv[0]);
+    close(ctx.sv[1]);
+}
+
+static void run_route_cases(void) {
+    struct route_ctx ctx = {0};
+    size_t n = 0;
+    for (size_t i = 0; i < sizeof(hard_routes) / sizeof(hard_routes[0]); i++, n++) {
+        ctx.endpoints[n].val = sc_str_ref(hard_routes[i]);
+    }
+    for (size_t i = 0; i < sizeof(soft_routes) / sizeof(soft_routes[0]); i++, n++) {
+        ctx.endpoints[n].val = sc_str_ref(soft_routes[i]);
+        ctx.endpoints[n].soft = true;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (_sc_route_insert(&ctx.root, &ctx.endpoints[i]) != SC_OK) {
+            _sc_route_free(ctx.root);
+            return;
+        }
+    }
+
+    const char *hard[] = {"/small", "/api/orders", "/health", "/upload"};
+    const char *soft[] = {"/soft/items/42", "/static/css/main.css", "/api/v2/orders", "/api/users/42"};
+    const char *miss[] = {"/missing", "/api/unknown", "/smallest", "/favicon.ico"};
+    for (int i = 0; i < 4; i++) ctx.uris[i] = sc_str_ref(hard[i]);
+    run_case("route_find/hard", bench_route, &ctx);
+    for (int i = 0; i < 4; i++) ctx.uris[i] = sc_str_ref(soft[i]);
+    run_case("route_find/soft", bench_route, &ctx);
+    for (int i = 0; i < 4; i++) ctx.uris[i] = sc_str_ref(miss[i]);
+    run_case("route_find/miss", bench_route, &ctx);
+
+    _sc_route_free(ctx.root);
+}
+
+static void run_builder_cases(void) {
+    struct build_ctx ctx = {NULL, "Hello, world!\n"};
+    run_case("easy_request_build/no_headers", bench_request_build, &ctx);
+
+    ctx.headers = sc_header_append("Content-Type: text/plain", NULL);
+    ctx.headers = sc_header_append("Cache-Control: no-store", ctx.headers);
+    ctx.headers = sc_header_append("X-Request-Id: 0b6e4f7a-2d1c-4e9b", ctx.headers);
+    run_case("easy_request_build/3_headers", bench_request_build, &ctx);
+    sc_headers_free(ctx.headers);
+
+    run_case("header_append/8", bench_header_append, NULL);
+}
+
+static void run_str_cases(void) {
+    // copies, so the comparisons can't stop at equal pointers
+    char a[] = "/api/v2/orders/1042/items";
+    char b[] = "/api/v2/orders/1042/items";
+    char c[] = "/api/v2/orders/1042/itemz";
+
+    struct str_ctx ctx = {sc_str_ref(a), sc_str_ref(b)};
+    run_case("strcmp/equal", bench_strcmp, &ctx);
+    ctx.b = sc_str_ref(c);
+    run_case("strcmp/last_byte", bench_strcmp, &ctx);
+    ctx.b = sc_str_ref_n(b, 15);
+    run_case("strprefix/hit", bench_strprefix, &ctx);
+    ctx.b = sc_str_ref("/static/");
+    run_case("strprefix/miss", bench_strprefix, &ctx);
+}
+
+int main(int argc, char **argv) {
+    const char *corpus = SC_CORPUS_DIR;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:f:j")) != -1) {
+        switch (opt) {
+            case 'c': corpus = optarg; break;
+            case 't': s_case_time = atof(optarg); break;
+            case 'f': s_filter = optarg; break;
+            case 'j': s_json = true; break;
+            default:
+                fprintf(stderr, "usage: %s [-c corpus dir] [-t seconds per case] [-f name filter] [-j]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (s_case_time <= 0 || corpus_load(corpus) != 0) {
+        free(s_requests);
+        return 1;
+    }
+
+#ifndef __OPTIMIZE__
+    fprintf(stderr, "microbench: built without optimizations, configure with -DCMAKE_BUILD_TYPE=Release\n");
+#endif
+
+    if (s_json) {
+        printf("{\"cases\": [");
+    }
+    run_parse_cases();
+    run_route_cases();
+    run_builder_cases();
+    run_str_cases();
+    if (s_json) {
+        printf("\n]}\n");
+    }
+
+    free(s_requests);
+    return 0;
+}
@@ -0,0 +1,94 @@
+/* HTTP load generator, for pointing at any server on the network:
+ *
+ *     sc_load -c 64 -d 10 127.0.0.1:8000/root
+ *
+ * usage: sc_load [-c connections] [-t threads] [-d seconds] [-w warmup seconds] [-m method] [-b body bytes]
+ *                [-C (Connection: close)] [-j (JSON output)] host:port[/path] */
+
+#include "load.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void usage(const char *name) {
+    fprintf(stderr, "usage: %s [-c connections] [-t threads] [-d seconds] [-w warmup seconds] [-m method] "
+            "[-b body bytes] [-C] [-j] host:port[/path]\n", name);
+}
+
+int main(int argc, char **argv) {
+    load_config config = {
+        .method = "GET",
+        .path = "/",
+        .keep_alive = true,
+        .connections = 64,
+        .threads = (int) sysconf(_SC_NPROCESSORS_ONLN),
+        .duration = 10,
+        .warmup = 1,
+    };
+    bool json = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:d:w:m:b:Cj")) != -1) {
+        switch (opt) {
+            case 'c': config.connections = atoi(optarg); break;
+            case 't': config.threads = atoi(optarg); break;
+            case 'd': config.duration = atof(optarg); break;
+            case 'w': config.warmup = atof(optarg); break;
+            case 'm': config.method = optarg; break;
+            case 'b': config.body_size = strtoull(optarg, NULL, 10); break;
+            case 'C': config.keep_alive = false; break;
+            case 'j': json = true; break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    // host:port[/path]
+    char target[256];
+    snprintf(target, sizeof(target), "%s", argv[optind]);
+    char *slash = strchr(target, '/');
+    if (slash != NULL) {
+        config.path = argv[optind] + (slash - target);
+        *slash = '\0';
+    }
+    char *colon = strchr(target, ':');
+    if (colon == NULL) {
+        usage(argv[0]);
+        return 2;
+    }
+    *colon = '\0';
+    config.host = target;
+    config.port = atoi(colon + 1);
+
+    load_fd_limit_raise();
+
+    load_result *result = malloc(sizeof(*result));
+    if (result == NULL || load_run(&config, result) != 0) {
+        fprintf(stderr, "%s: couldn't start the load\n", argv[0]);
+        free(result);
+        return 1;
+    }
+
+    if (json) {
+        load_print_json(stdout, NULL, &config, result);
+        printf("\n");
+    } else {
+        printf("%llu requests in %.1fs, %.0f req/s, %.2f MB/s, %llu non-2xx, %llu errors\n",
+               (unsigned long long) result->requests, result->elapsed, result->requests / result->elapsed,
+               result->bytes / result->elapsed / 1e6, (unsigned long long) result->non_2xx,
+               (unsigned long long) result->errors);
+        printf("latency p50 %.1fus  p99 %.1fus  p99.9 %.1fus  max %.1fus\n",
+               load_percentile(result, 0.5) / 1e3, load_percentile(result, 0.99) / 1e3,
+               load_percentile(result, 0.999) / 1e3, result->max_ns / 1e3);
+    }
+
+    free(result);
+    return 0;
+}
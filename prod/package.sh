@@ -9,8 +9,20 @@ echo "#include \"sculpt.h\"" >> "$output"
 echo "" >> "$output"
 
 src_files=(
-    "../src/sculpt_util.c" # util has to be the first file because of the sc_log function
+    "../src/sculpt_log.c" # log has to be the first file because of the sc_log function
+    "../src/sculpt_util.c"
     "../src/sculpt_header.c"
+    "../src/sculpt_arena.c"
+    "../src/sculpt_scan.c"
+    "../src/sculpt_parse.c"
+    "../src/sculpt_timer.c"
+    "../src/sculpt_router.c"
+    "../src/sculpt_static.c"
+    "../src/sculpt_access.c"
+    "../src/sculpt_metrics.c"
+    "../src/sculpt_overload.c"
+    "../src/sculpt_handoff.c"
+    "../src/sculpt_uring.c"
     "../src/sculpt_conn.c"
     "../src/sculpt_mgr.c"
 )
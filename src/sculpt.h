@@ -1,6 +1,11 @@
 #ifndef SCULPT_H
 #define SCULPT_H
 
+// needed for accept4() and other linux specific calls
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <netdb.h>
 #include <stdbool.h>
@@ -11,7 +16,10 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
 
 #define SC_OK 0
 #define SC_SOCKET_BIND_ERR -1
@@ -32,25 +40,80 @@
 #define SC_FINISHED -16
 #define SC_BUFFER_OVERFLOW_ERR -17
 #define SC_MALFORMED_HEADER_ERR -18
+#define SC_THREAD_CREATION_ERR -19
+#define SC_BODY_TOO_LARGE_ERR -20
+#define SC_MALFORMED_BODY_ERR -21
+#define SC_IO_URING_ERR -22
+#define SC_HANDOFF_ERR -23
+#define SC_HEADER_TOO_LARGE_ERR -24
+#define SC_NOT_IMPLEMENTED_ERR -25
+#define SC_HEADER_PARSE_ERR -256
+#define SC_HEADER_PARSE_INCOMPLETE_ERR -257
 
 #define SC_DEFAULT_BACKLOG 128
 #define SC_DEFAULT_EPOLL_MAXEVENTS 12
+#define SC_DEFAULT_ACCEPT_BUDGET 32
 #define HOST_BUF_LEN NI_MAXHOST
 #define SERV_BUF_LEN NI_MAXSERV
 #define SC_DEFAULT_CONN_TIMEOUT 60
 #define SC_DEFAULT_CONN_MAX_AGE 300
 #define SC_ENDPOINT_LEN 256
 #define HEADER_BUF_SIZE 1024
-#define METHOD_BUF_SIZE 16
-#define URL_BUF_SIZE 128
 #define SC_CONTINUE 1
+#define SC_PENDING 2
 #define SC_MAX_HEADER_ERROR_COUNT 12
+#define SC_CONN_READ_BUF_SIZE 8192
+#define SC_MAX_REQUEST_HEADERS 64
+#define SC_CONN_WRITE_BUF_SIZE 4096
+#define SC_CONN_COALESCE_MAX 16384
+#define SC_DEFAULT_WRITE_HIGH_WATER (256 * 1024)
+#define SC_EASY_IOV_COUNT 64
+#define SC_EASY_HEAD_SIZE 256
+#define SC_WORKER_POLL_TIMEOUT 100
+#define SC_TIMER_WHEEL_BITS 6
+#define SC_TIMER_WHEEL_SLOTS (1 << SC_TIMER_WHEEL_BITS)
+#define SC_TIMER_WHEEL_LEVELS 4
+#define SC_FILE_CACHE_BUCKETS 64
+#define SC_FILE_CACHE_MAX 256
+#define SC_FILE_CACHE_TTL 2
+#define SC_SENDFILE_CHUNK (1024 * 1024)
+#define SC_DEFAULT_MAX_BODY_SIZE (16 * 1024 * 1024)
+#define SC_STREAM_PRODUCE_ROUNDS 16
+#define SC_ARENA_BLOCK_SIZE 4096
+#define SC_HEADER_BUCKETS 32
+#define SC_LOG_RING_SIZE 1024
+#define SC_LOG_RECORD_SIZE 256
+#define SC_LOG_BATCH_SIZE (64 * 1024)
+#define SC_LOG_FLUSH_INTERVAL_MS 10
+#define SC_DEFAULT_ACCESS_LOG_SIZE (64 * 1024 * 1024)
+#define SC_ACCESS_LOG_MIN_SIZE (64 * 1024)
+#define SC_ACCESS_LOG_URI_CACHE 1024
+#define SC_ACCESS_LOG_PENDING 8
+#define SC_METRICS_BUCKETS 52
+#define SC_URING_ENTRIES 2048
+#define SC_URING_BUFFERS 1024
+#define SC_URING_BUFFER_SIZE 4096
+#define SC_CONN_SLAB_SIZE 64
+#define SC_CONN_SLAB_IDLE 30
+#define SC_CACHE_LINE 64
+#define SC_HANDOFF_TIMEOUT 5
+
+#define SC_BACKEND_EPOLL 0
+#define SC_BACKEND_IO_URING 1
+#define SC_SHED_REJECT 0
+#define SC_SHED_DEFER 1
+#define SC_RETRY_AFTER "1"
 
 #define SC_LL_NONE 0
 #define SC_LL_MINIMAL 1
 #define SC_LL_NORMAL 2
 #define SC_LL_DEBUG 3
 
+/* messages above this level are compiled out, build with -DSC_LOG_LEVEL_MAX=SC_LL_NORMAL to drop the debug ones */
+#ifndef SC_LOG_LEVEL_MAX
+#define SC_LOG_LEVEL_MAX SC_LL_DEBUG
+#endif
+
 // utils
 
 /* Describes a string with len attribute. The string can either be kept as a copy of the memory passed in the mk methods, or as a reference.*/
@@ -80,20 +143,60 @@ void sc_str_free(sc_str *str);
 int sc_strcmp(const sc_str str1, const sc_str str2);
 /* checks if the prefix is present in the string */
 bool sc_strprefix(const sc_str str, const sc_str prefix);
+/* checks if the suffix is present in the string */
+bool sc_strsuffix(const sc_str str, const sc_str suffix);
 
 /* describes the basic necessary info about an http message for virtually any rquest */ 
+/* Note: for incoming requests, uri and method are NUL-terminated views into the connection buffer, valid until the handler returns. */
 typedef struct {
     sc_str uri;
     sc_str method;
 } sc_http_msg;
 
 /* struct to hold headers of a request */
+/* Headers of an incoming request are NUL-terminated views into the connection buffer, without the trailing \r\n.
+ * They are only valid until the handler returns, and are never freed by sc_headers_free(). */
 typedef struct _header_list {
     sc_str header;
+    bool ref;               // true if the node and its string are not owned by the list
     struct _header_list *next;
 } sc_headers;
 
+/* common request headers, which the parser files by name while it reads them */
+typedef enum {
+    SC_HEADER_HOST,
+    SC_HEADER_CONNECTION,
+    SC_HEADER_CONTENT_LENGTH,
+    SC_HEADER_CONTENT_TYPE,
+    SC_HEADER_TRANSFER_ENCODING,
+    SC_HEADER_EXPECT,
+    SC_HEADER_ACCEPT,
+    SC_HEADER_ACCEPT_ENCODING,
+    SC_HEADER_AUTHORIZATION,
+    SC_HEADER_COOKIE,
+    SC_HEADER_USER_AGENT,
+    SC_HEADER_ORIGIN,
+    SC_HEADER_REFERER,
+    SC_HEADER_IF_NONE_MATCH,
+    SC_HEADER_IF_MODIFIED_SINCE,
+    SC_HEADER_RANGE,
+    SC_HEADER_X_FORWARDED_FOR,
+    SC_HEADER_X_REQUEST_ID,
+    SC_HEADER_COUNT
+} sc_header_id;
+
+/* Value of a known header of the request being handled on fd, without the surrounding whitespace, in O(1).
+ * The value is a view into the connection buffer, valid until the handler returns. buf is NULL if the request
+ * doesn't have the header (or outside of a handler). When a header is repeated, the first one is returned. */
+sc_str sc_req_header_get(int fd, sc_header_id id);
+/* Same as sc_req_header_get, for any header name (case-insensitive). Other names than the known ones are
+ * looked up in a hash table built while parsing. */
+sc_str sc_req_header_find(int fd, const char *name);
+
 sc_headers *sc_header_append(const char *header, sc_headers *list);
+/* Same as sc_header_append, but the node is allocated with sc_req_alloc(), so it is released with the request
+ * instead of by sc_headers_free(). Returns NULL outside of a handler. */
+sc_headers *sc_req_header_append(int fd, const char *header, sc_headers *list);
 void sc_headers_free(sc_headers *headers);
 void sc_header_free(sc_headers *headers);
 sc_headers *parse_headers(const char *headers_str);
@@ -109,19 +212,190 @@ typedef struct {
     int port;
 } sc_addr_info;
 
+/* intrusive timer node, linked in one slot of a _sc_timer_wheel */
+struct _sc_timer {
+    struct _sc_timer *prev;
+    struct _sc_timer *next;     // NULL when the timer is not armed
+    time_t deadline;
+    void *data;
+};
+
+/* hierarchical timer wheel with one second ticks. Adding or removing a timer is O(1), and advancing it only
+ * touches the timers that expire (plus the ones moving down a level once every SC_TIMER_WHEEL_SLOTS ticks). */
+struct _sc_timer_wheel {
+    struct _sc_timer slots[SC_TIMER_WHEEL_LEVELS][SC_TIMER_WHEEL_SLOTS];
+    time_t current;             // last tick processed
+};
+
+/* bump allocator for the data of one request. Allocating moves a pointer in the current block, and resetting it
+ * once the request is done frees everything at once, keeping the first block for the next request. */
+struct _sc_arena {
+    struct _sc_arena_block *blocks;     // newest block first
+    struct _sc_arena_block *base;       // first block, kept between requests
+    char *ptr;                          // free space of the newest block
+    char *end;
+};
+
+/* header that isn't one of the sc_header_id ones, filed in the hash table of the request */
+struct _sc_header_entry {
+    unsigned int hash;
+    sc_str name;
+    sc_str value;
+    struct _sc_header_entry *next;
+};
+
+/* request being timed for the access log and metrics, and the finished ones whose response is still being sent */
+struct _sc_access_req {
+    uint64_t start;             // monotonic ns when the loop first saw the request, 0 between requests
+    uint64_t real;              // wall clock time of start, ns since the epoch
+    uint64_t parsed;            // when its head was parsed
+    uint64_t out_start;         // conn->out_bytes at start
+    int status;                 // status of its response, 0 until one is sent through the framework
+    int pending_count;
+    struct {
+        uint32_t index;         // entry in the log file
+        uint32_t generation;    // file the entry is in, rotation replaces it
+        uint64_t done;          // when the request was done, its send time starts there
+        uint64_t out_start;
+        int endpoint;           // id of its endpoint, -1 if none matched
+    } pending[SC_ACCESS_LOG_PENDING];
+};
+
+/* resumable request parser state. It is kept per connection, so a request split across several reads
+ * continues from the last complete line instead of being parsed from the start again. */
+struct _sc_parser {
+    enum {
+        SC_PARSE_REQUEST_LINE,
+        SC_PARSE_HEADERS,
+        SC_PARSE_BODY,
+        SC_PARSE_DONE
+    } state;
+    size_t pos;             // offset in the read buffer of the first unparsed line, the end of the head once parsed
+    size_t scan;            // offset up to which the read buffer was already searched for a line end
+    sc_http_msg msg;
+    size_t header_count;    // headers parsed so far
+    sc_headers *headers;    // list of the parsed headers, allocated in the connection arena
+    sc_headers *headers_tail;
+    bool keep_alive;
+    bool http11;            // HTTP/1.1 or later, where connections are persistent by default
+    sc_str known[SC_HEADER_COUNT];          // values of the known headers, by sc_header_id
+    struct _sc_header_entry **unknown;      // SC_HEADER_BUCKETS chains of the other headers, in the arena
+    bool expect_continue;   // the client waits for a 100 Continue before sending the body
+
+    // the body streams through the read buffer after the head, which stays in place for the handler
+    enum {
+        SC_BODY_DATA,
+        SC_BODY_CHUNK_SIZE,
+        SC_BODY_CHUNK_END,
+        SC_BODY_TRAILERS
+    } body_state;
+    bool chunked;
+    bool has_length;
+    size_t body_pos;        // offset in the read buffer of the first body byte not handed out yet
+    size_t body_left;       // bytes left in the body, or in the current chunk
+    size_t body_read;       // body size so far, the whole Content-Length at once
+    size_t body_max;
+    struct _endpoint_list *route;   // endpoint the request was routed to, NULL if none matched
+};
+
+/* state of a connection served by the io_uring backend, see sculpt_uring.c */
+struct _sc_uring_conn {
+    bool active;            // the connection belongs to a loop running on io_uring
+    bool closed;            // waiting for its operations to complete before it is released
+    bool recv_armed;        // a multishot recv is in flight
+    bool recv_cancelling;
+    bool poll_armed;        // waiting for the socket to take more, for a file body or a producer
+    bool eof;               // the client shut down its side, after the data still held
+    int ops;                // operations in flight
+    int held_head;          // received buffers not copied into rbuf yet, by buffer id, -1 if none
+    int held_tail;
+    char *sbuf;             // output handed to the send in flight, swapped with wbuf so new output can't move it
+    size_t sbuf_cap;
+    size_t sbuf_off;
+    size_t sbuf_len;
+    bool starved;           // its recv ran out of buffers, it is armed again once some are returned
+    struct sc_conn *starved_next;
+    bool handoff;           // closed to be handed to the next process, unless something arrived meanwhile
+};
+
+struct _sc_conn_slab;
+
 typedef struct sc_conn {
-    int fd;
-    time_t last_active;         // when connection was last used
-    time_t creation_time;     // when connection was created
+    // looked at on every event and timer tick, together in the first cache line
+    _Alignas(SC_CACHE_LINE) int fd;
     enum {
         CONN_IDLE,
         CONN_ACTIVE,
         CONN_CLOSING
     } state;
+    uint32_t events;            // epoll events the connection is registered for
+    bool read_closed;           // the client shut down its side, nothing more will be read
+    bool closing;               // no more requests are served, the connection closes once the queue is empty
+    time_t last_active;         // when connection was last used (monotonic seconds)
+    struct _sc_timer timer;     // idle and max-age expiry
+
+    // request reading
+    _Alignas(SC_CACHE_LINE) char *rbuf;     // receive buffer, filled with large reads and kept between events
+    size_t rbuf_len;            // bytes currently held in rbuf
+    size_t rbuf_cap;            // rbuf capacity
+    struct _sc_parser parser;
+    struct _sc_arena arena;     // memory of the request being served, see sc_req_alloc()
+
+    // response writing
+    char *wbuf;                 // output queue: responses not yet accepted by the socket, written at once
+    size_t wbuf_off;            // offset of the first unsent byte
+    size_t wbuf_len;
+    size_t wbuf_cap;
+    struct _sc_file *file;      // file whose body is sent with sendfile() once wbuf is empty, NULL if none
+    off_t file_off;
+    off_t file_end;
+    bool streaming;             // a streamed response was started and not ended yet
+    bool stream_raw;            // the streamed response goes out unframed and ends with the connection (HTTP/1.0)
+    int (*producer)(int, void *);   // called for more of the streamed response when the socket can take it
+    void *producer_ctx;
+    uint64_t out_bytes;         // response bytes queued since the connection was accepted
+
+    // rarely used
+    struct sockaddr_in peer;    // client address
+    time_t creation_time;     // when connection was created (monotonic seconds)
+    struct _sc_access_req access;   // only used while the access log or metrics are enabled
+    struct _sc_uring_conn uring;    // only used when the loop runs on io_uring
+    struct _sc_conn_slab *slab;     // slab the connection was allocated in
+
     struct sc_conn *next;
 } sc_conn;
 
-typedef struct {
+/* The pool allocates its connections SC_CONN_SLAB_SIZE at a time, as clients arrive, up to max_conn. Slabs with
+ * free connections are kept in a list, the partly used ones first so new clients fill them, and a slab whose
+ * connections were all free for SC_CONN_SLAB_IDLE seconds is given back together with their buffers. */
+struct _sc_conn_slab {
+    sc_conn conns[SC_CONN_SLAB_SIZE];
+    sc_conn *free;                  // its free connections
+    int used;
+    int index;                      // in mgr->slabs
+    time_t empty_since;
+    struct _sc_conn_slab *prev;     // in the list of slabs with free connections
+    struct _sc_conn_slab *next;
+};
+
+/* counters of one loop. Only its thread writes them, with relaxed atomic stores, so the metrics endpoint of any
+ * loop can read them */
+struct _sc_loop_stats {
+    uint64_t polls;                 // epoll_wait() calls that returned events
+    uint64_t events;                // events they returned
+    uint64_t last_batch;
+    uint64_t accepted;
+    uint64_t rejected;              // clients turned away with a 503 because the pool was full
+    uint64_t timeouts;              // connections closed for being idle or too old
+    uint64_t allocated;             // connections in the slabs of the pool, used or not
+    uint64_t shed;                  // clients turned away with a 503 because the loop was overloaded
+    uint64_t lag_ns;                // moving average of how long the handled events were waiting
+    uint64_t handed_off;            // idle connections passed to the next process while draining
+};
+
+#define _SC_STAT_ADD(stat, n) __atomic_store_n(&(stat), (stat) + (n), __ATOMIC_RELAXED)
+
+typedef struct sc_conn_mgr {
     sc_addr_info addr_info;         
     int fd;                         // server file descriptor
     int backlog;                    // server backlog count
@@ -129,21 +403,72 @@ typedef struct {
     char service_buf[SERV_BUF_LEN]; // service buffer
 
     // Connection pool management  
-    sc_conn *conn_pool;             // main connection pool
-    sc_conn *free_conns;            // free connection pool
+    struct _sc_conn_slab **slabs;   // room for every slab the pool may have, NULL where none is allocated
+    int slab_count;
+    int slabs_allocated;
+    struct _sc_conn_slab *open_slabs;       // slabs with free connections, the empty ones last
+    struct _sc_conn_slab *open_slabs_tail;
+    time_t pool_checked;            // when empty slabs were last looked for
     int max_conn_count;             // max connection count
     int conn_count;         // current connection count
     time_t conn_timeout;            // max connection idle time before closing
     time_t conn_max_age;            // max connection lifetime
+    struct _sc_timer_wheel timers;  // connection expiry timers
+    time_t now;                     // monotonic clock, read once per loop iteration
 
     // epoll
     int epoll_fd;       // epoll file descriptor
     struct epoll_event *events;
     size_t max_events;              // max number of epoll events
     struct epoll_event epoll_event; // server epoll event
+    int backend;                    // SC_BACKEND_*, set up by sc_mgr_epoll_init()
+    struct _sc_uring *uring;        // io_uring of this loop, NULL when it runs on epoll
+
+    // accepting
+    int accept_budget;              // max clients accepted per loop iteration
+    bool listener_et;               // listening socket registered in edge-triggered mode
+    bool accept_pending;            // the budget ran out before the accept queue was drained
+
+    size_t write_high_water;        // queued output per connection above which its requests stop being read
+    size_t max_body_size;           // largest request body accepted, larger ones get a 413
+
+    // overload shedding, see sc_mgr_overload_set()
+    uint64_t lag_target_ns;         // 0 when disabled
+    int shed_mode;
+    bool shedding;                  // the lag went over the target and didn't come back under half of it yet
+    bool behind;                    // the last batch left ready events for the next one
+    uint64_t behind_since;          // start of the first batch since the loop last caught up
+    uint64_t event_ns;              // moving average of the time one event takes to handle
+    int admitted;                   // clients admitted since the loop last caught up
+
+    // binary upgrade, see sc_mgr_handoff_enable() and sc_mgr_takeover(). Only the main loop has it
+    struct _sc_handoff *handoff;
+    bool draining;                  // the listening socket went to the next process, waiting for the connections
+    bool drained;                   // no connection is left, read by the main loop for every loop
+
+    // event loop threads
+    struct sc_conn_mgr *parent;             // manager a worker loop was cloned from, NULL for the main loop
+    struct sc_conn_mgr **workers;           // worker loops started by sc_mgr_run_threads()
+    pthread_t *threads;
+    int worker_count;
+    bool stopping;                          // set on the main loop to stop its workers
 
     // misc
-    struct _endpoint_list *endpoints; //linked list of endpoints
+    struct _endpoint_list *endpoints; //linked list of endpoints, shared read-only with the worker loops
+    struct _route_node *routes;       // radix tree over the endpoints, used for lookups
+    struct _sc_file_cache *files;     // open fds and stat results of static files, one cache per loop
+    struct _sc_access_log *access_log;  // mmap'd access log of this loop, NULL if disabled
+    struct _sc_metrics *metrics;        // per endpoint counters and histograms of this loop, NULL if disabled
+    struct _sc_loop_stats stats;
+    int endpoint_count;                 // endpoints bound so far, their ids are below it
+    sc_str response_404;              // pre-serialized responses the loop sends on its own, shared read-only
+    sc_str response_404_close;        // with the worker loops. The 404 comes in both Connection variants
+    sc_str response_500;
+    sc_str response_503;
+    sc_str response_413;
+    sc_str response_400;
+    sc_str response_431;
+    sc_str response_501;
     bool listening;     // flag to check listening status
     int ll;
 } sc_conn_mgr;
@@ -152,11 +477,80 @@ sc_addr_info sc_addr_create(int sin_family, int port);
 sc_conn_mgr *sc_mgr_create(sc_addr_info mgr, int *err);
 int sc_mgr_listen(sc_conn_mgr *mgr);
 int sc_mgr_epoll_init(sc_conn_mgr *mgr);
+
+/* Sets up the connection pool. max_conn is only a cap: the connections are allocated as clients arrive and given
+ * back once they stay unused, so it can be set for the peak without reserving the memory. Clients over the cap get
+ * a 503. */
 int sc_mgr_conn_pool_init(sc_conn_mgr *mgr, int max_conn);
 
 void sc_mgr_backlog_set(sc_conn_mgr *mgr, int backlog);
 void sc_mgr_epoll_maxevents_set(sc_conn_mgr *mgr, int maxevents);
 void sc_mgr_ll_set(sc_conn_mgr *mgr, int ll);
+/* sets how many clients are accepted per loop iteration at most (SC_DEFAULT_ACCEPT_BUDGET by default) */
+void sc_mgr_accept_budget_set(sc_conn_mgr *mgr, int budget);
+/* registers the listening socket in edge-triggered mode, so the accept queue is only reported once per burst */
+int sc_mgr_listener_et_set(sc_conn_mgr *mgr, bool et);
+/* sets how many bytes of output may be queued for a slow client before reading its requests is paused */
+void sc_mgr_write_high_water_set(sc_conn_mgr *mgr, size_t bytes);
+/* sets the largest request body accepted (SC_DEFAULT_MAX_BODY_SIZE by default). Larger requests get a 413 */
+void sc_mgr_max_body_size_set(sc_conn_mgr *mgr, size_t bytes);
+/* Replaces the response the server sends on its own for code 404 (no endpoint matched), 500 (the request couldn't be
+ * handled), 503 (the connection pool is full or the loop is overloaded, sent with Retry-After) or 413 (the request body is too large).
+ * Malformed requests get a 400, a request head that doesn't fit in the read buffer or has too many headers a 431,
+ * and a Transfer-Encoding other than chunked a 501. content_type is a full header line, like in sc_easy_send().
+ * It is serialized once here, so it must be set before sc_mgr_run_threads(). */
+int sc_mgr_err_response_set(sc_conn_mgr *mgr, int code, const char *content_type, const char *body);
+
+/* Records every request into a binary access log at path: fixed-size entries appended to a memory-mapped file,
+ * which is rotated to path.old once it holds max_size bytes (SC_DEFAULT_ACCESS_LOG_SIZE if 0). Worker loops
+ * started afterwards write to path.1, path.2 and so on. An existing log at path is rotated first.
+ * tools/sc_access_dump.c converts the files to text. */
+int sc_mgr_access_log_enable(sc_conn_mgr *mgr, const char *path, size_t max_size);
+
+/* Counts requests, status classes and bytes, and records parse, handler and write time histograms, for every
+ * endpoint. They are served in the Prometheus text format on endpoint, together with the connection and loop
+ * counters. Each loop records its own numbers without locks, the endpoint adds them up. It must be enabled after
+ * binding the other endpoints and before sc_mgr_run_threads(). */
+int sc_mgr_metrics_enable(sc_conn_mgr *mgr, const char *endpoint);
+
+/* Chooses how the loop waits for events: SC_BACKEND_EPOLL (the default) or SC_BACKEND_IO_URING, which accepts,
+ * receives and sends through an io_uring so a whole batch takes a single system call. It is set up by
+ * sc_mgr_epoll_init(), so it must be chosen before, and the worker loops use the same one. io_uring needs a build
+ * with SC_IO_URING defined (SC_IO_URING_ERR otherwise) and Linux 6.0 or later; without it, the loop runs on epoll. */
+int sc_mgr_backend_set(sc_conn_mgr *mgr, int backend);
+
+/* Sheds new clients when a loop falls behind. Each loop keeps a moving average of how long the events it handles
+ * were waiting: a batch counts from the last time the loop had no more ready events than it could take at once,
+ * so it grows with the handler time and with the number of events queued behind. Once it goes over lag_ms, the
+ * loop stops admitting clients until it is back under half of it, and below that it only admits as many as it
+ * can serve within lag_ms at its average time per event. With SC_SHED_REJECT the others are accepted, sent the
+ * 503 response (with Retry-After) and closed, with SC_SHED_DEFER they are left in the kernel accept queue. The
+ * connections already open keep being served. 0 disables it, the default. */
+int sc_mgr_overload_set(sc_conn_mgr *mgr, int lag_ms, int mode);
+
+/* Hands the server over to the next process for a binary upgrade: the main loop listens on a Unix socket at path
+ * (replacing a file left there) and checks it once a second. When a new process calls sc_mgr_takeover() with the
+ * same path, it is sent the listening socket of every loop, so no client in the accept queue is dropped. Then the
+ * loops stop accepting and finish the requests in flight; their idle keep-alive connections are passed to the new
+ * process as well when conns is true, closed otherwise. sc_mgr_drained() tells when none is left. Must be called
+ * before sc_mgr_run_threads(). */
+int sc_mgr_handoff_enable(sc_conn_mgr *mgr, const char *path, bool conns);
+
+/* Takes the listening sockets over from the process serving at path, see sc_mgr_handoff_enable(). It replaces the
+ * socket of sc_mgr_create(), so it must be called before sc_mgr_epoll_init(), and the worker loops take the others;
+ * with fewer loops than the old process, the sockets left are closed with the clients queued on them. The main loop
+ * then adopts the connections the old one passes while it drains, as long as its slice of the pool has room.
+ * Returns SC_HANDOFF_ERR if there is no process to take over from, and the server keeps its own socket. */
+int sc_mgr_takeover(sc_conn_mgr *mgr, const char *path);
+
+/* true once the server was handed over and every loop finished its connections, when the process can exit */
+bool sc_mgr_drained(sc_conn_mgr *mgr);
+
+/* Starts n - 1 worker event loops, each on its own thread, so n loops serve requests together with the caller's
+ * sc_mgr_poll() loop. Every loop has its own SO_REUSEPORT listening socket, epoll instance and slice of the
+ * connection pool; only the endpoints are shared, so they must all be bound before calling this.
+ * The workers are stopped and joined by sc_mgr_finish(). */
+int sc_mgr_run_threads(sc_conn_mgr *mgr, int n);
 
 void sc_mgr_finish(sc_conn_mgr *mgr);
 void sc_mgr_conn_pool_destroy(sc_conn_mgr *mgr);
@@ -167,22 +561,250 @@ void sc_mgr_conns_cleanup(sc_conn_mgr *mgr);
 
 int sc_mgr_poll(sc_conn_mgr *mgr, int timeout_ms);
 
+// access log file format
+
+#define SC_ACCESS_LOG_MAGIC 0x4c414353  // "SCAL"
+#define SC_ACCESS_LOG_VERSION 1
+
+/* first 64 bytes of an access log file. The entries follow it, and the URIs they point to are stored from the
+ * end of the file down, each once, as a 16 bit length followed by its bytes */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entry_size;        // sizeof(sc_access_entry)
+    uint32_t entry_count;       // entries written so far, updated after each one
+    uint64_t size;              // file size
+    uint64_t strings_start;     // offset of the lowest URI
+    char reserved[32];
+} sc_access_log_header;
+
+typedef struct {
+    uint64_t time;              // when the request started arriving, ns since the epoch
+    uint64_t bytes;             // response bytes, headers included
+    uint8_t addr[16];           // client address, IPv4 addresses are mapped into IPv6 (::ffff:a.b.c.d)
+    uint16_t port;
+    uint16_t status;            // 0 if the response wasn't sent through the framework
+    uint32_t uri_hash;          // FNV-1a of the URI
+    uint32_t uri_off;           // offset of the URI in the file, 0 if the request line couldn't be parsed
+    uint32_t parse_us;          // from the first byte of the request to its parsed head
+    uint32_t handler_us;        // from the parsed head to the end of the request, body and handler included
+    uint32_t send_us;           // from the end of the request until the socket took the whole response,
+                                // UINT32_MAX if the connection closed first
+    char method[8];             // NUL-padded, truncated
+} sc_access_entry;
+
+// access log (internal)
+
+/* opens the log file of worker loop index, named after the one of the main loop */
+struct _sc_access_log *_sc_access_log_worker(sc_conn_mgr *mgr, int index, int *err);
+void _sc_access_log_destroy(sc_conn_mgr *mgr);
+/* per request hooks, called by the loop only while the access log is enabled */
+void _sc_access_begin(sc_conn_mgr *mgr, sc_conn *conn);
+void _sc_access_parsed(sc_conn_mgr *mgr, sc_conn *conn);
+void _sc_access_end(sc_conn_mgr *mgr, sc_conn *conn);
+/* closes the send time of the logged requests of the connection. complete is false if it closed before */
+void _sc_access_sent(sc_conn_mgr *mgr, sc_conn *conn, bool complete);
+/* sets the status of the request from a pre-serialized response */
+void _sc_access_status(sc_conn *conn, sc_str response);
+
+// metrics (internal)
+
+struct _sc_metrics *_sc_metrics_create(int endpoint_count);
+void _sc_metrics_destroy(sc_conn_mgr *mgr);
+/* makes room for the counters of an endpoint bound after the metrics were enabled */
+int _sc_metrics_grow(sc_conn_mgr *mgr);
+void _sc_metrics_request(sc_conn_mgr *mgr, sc_conn *conn, uint32_t parse_us, uint32_t handler_us);
+void _sc_metrics_sent(sc_conn_mgr *mgr, int endpoint, uint32_t write_us, uint64_t bytes);
+void _sc_metrics_serve(sc_conn_mgr *mgr, int fd);
+
+// timers (internal)
+
+time_t _sc_clock_now(void);
+uint64_t _sc_clock_ns(void);
+void _sc_timer_wheel_init(struct _sc_timer_wheel *wheel, time_t now);
+void _sc_timer_add(struct _sc_timer_wheel *wheel, struct _sc_timer *timer, time_t deadline);
+void _sc_timer_del(struct _sc_timer *timer);
+int _sc_timer_wheel_advance(struct _sc_timer_wheel *wheel, time_t now, void (*expire)(struct _sc_timer *, void *), void *ctx);
+
+// request arena (internal)
+
+void *_sc_arena_alloc(struct _sc_arena *arena, size_t size);
+void _sc_arena_reset(struct _sc_arena *arena);
+void _sc_arena_free(struct _sc_arena *arena);
+
+// request parsing (internal)
+
+/* returns the offset of the first byte of buf that is delim or a control byte (other than tab), or len if there is
+ * none. It checks 16 or 32 bytes at a time with SSE4.2 or AVX2 when the CPU has them */
+size_t _sc_scan(const char *buf, size_t len, char delim);
+
+void _sc_parser_reset(sc_conn *conn);
+/* splits the request line (without its line end) in place into http_msg's method and uri */
+int get_http_msg(char *header, size_t len, sc_http_msg *http_msg);
+int _sc_request_parse(sc_conn *conn, size_t max_body);
+sc_headers *_sc_request_headers(sc_conn *conn);
+/* hands out the next piece of the request body received so far. Returns SC_OK with a chunk, SC_FINISHED once the
+ * whole body was read, or SC_HEADER_PARSE_INCOMPLETE_ERR if it has to wait for more data */
+int _sc_body_next(sc_conn *conn, sc_str *chunk);
+void _sc_request_consume(sc_conn *conn);
+
+// io_uring backend (internal)
+
+int _sc_uring_init(sc_conn_mgr *mgr);
+void _sc_uring_destroy(sc_conn_mgr *mgr);
+int _sc_uring_poll(sc_conn_mgr *mgr, int timeout_ms);
+/* hands the queued output to a send, returns SC_PENDING while one is in flight */
+int _sc_uring_flush(sc_conn_mgr *mgr, sc_conn *conn);
+void _sc_uring_update(sc_conn_mgr *mgr, sc_conn *conn, bool want_read, bool want_write);
+/* closes the connection, which is released once its operations in flight completed */
+void _sc_uring_close(sc_conn_mgr *mgr, sc_conn *conn);
+/* starts receiving on a connection that was just taken from the pool, its fd set */
+void _sc_uring_open(sc_conn_mgr *mgr, sc_conn *conn);
+/* like _sc_uring_close(), but the fd is passed to the new process once the recv was cancelled */
+void _sc_uring_hand_off(sc_conn_mgr *mgr, sc_conn *conn);
+/* cancels the accepts of the listening socket */
+void _sc_uring_unlisten(sc_conn_mgr *mgr);
+
+// overload shedding (internal)
+
+/* called when a batch of events starts being handled, returns its start time */
+uint64_t _sc_overload_begin(sc_conn_mgr *mgr);
+/* adds the batch of events that started at start_ns to the lag average, behind telling if it left ready events
+ * for the next one. Returns true when the loop started or stopped shedding */
+bool _sc_overload_update(sc_conn_mgr *mgr, uint64_t start_ns, int events, bool behind);
+/* whether one more client can be admitted: the loop isn't shedding, and serving the clients admitted since it last
+ * caught up, the accepting ones about to be, and this one keeps it within the target */
+bool _sc_overload_admit(sc_conn_mgr *mgr, int accepting);
+/* shortens the poll timeout while shedding, so the average comes down once the loop is idle */
+int _sc_overload_timeout(sc_conn_mgr *mgr, int timeout_ms);
+
+// binary upgrade (internal)
+
+/* called by every loop after each batch: the main loop looks for a new process, then each loop starts draining
+ * once the listening sockets were handed over, and passes or closes its idle connections */
+void _sc_handoff_check(sc_conn_mgr *mgr);
+/* passes the connection fd to the new process, returns SC_PENDING if its socket is full */
+int _sc_handoff_send(sc_conn_mgr *mgr, int fd);
+/* adopts the connections the old process passed meanwhile, called when its socket is readable */
+void _sc_handoff_receive(sc_conn_mgr *mgr);
+/* the socket of the old process while it drains, -1 if none */
+int _sc_handoff_prev_fd(sc_conn_mgr *mgr);
+/* gives a worker loop the next listening socket taken over, if any is left */
+void _sc_handoff_worker(sc_conn_mgr *mgr, sc_conn_mgr *worker);
+void _sc_handoff_destroy(sc_conn_mgr *mgr);
+/* serves a connection passed by the old process. Returns SC_MALLOC_ERR and closes fd if the pool has no room */
+int _sc_conn_adopt(sc_conn_mgr *mgr, int fd);
+/* stops accepting, the listening socket is left to the new process */
+void _sc_conn_unlisten(sc_conn_mgr *mgr);
+/* walks the connections of a draining loop, handing over or closing the idle ones */
+void _sc_conn_drain(sc_conn_mgr *mgr);
+
+// response writing (internal)
+
+sc_conn *_sc_conn_current(int fd);
+/* whether the connection stays open after the response to the request being served, as its Connection header says */
+bool _sc_conn_keep_alive(const sc_conn *conn);
+/* serves the requests received so far and writes their responses, what every event on a connection leads to */
+void _sc_conn_serve(sc_conn_mgr *mgr, sc_conn *conn);
+int _sc_conn_write(sc_conn *conn, const char *data, size_t len);
+int _sc_conn_writev(sc_conn *conn, const struct iovec *iov, int iovcnt);
+size_t _sc_conn_pending(const sc_conn *conn);
+int _sc_conn_flush(sc_conn_mgr *mgr, sc_conn *conn);
+
+/* Allocates memory that lives until the request being handled on fd is done (its streamed response included),
+ * when it is all released at once. It is meant for the scratch data of handlers, which don't free it.
+ * Returns NULL outside of a handler, or if the memory couldn't be allocated. */
+void *sc_req_alloc(int fd, size_t size);
+
 // sending and recieving data utils
 
+/* Sends a full response: status line, content_type, headers and body. The headers list is freed afterwards.
+ * The pieces are sent with writev() without being copied into an intermediate buffer first. */
 int sc_easy_send(int fd, int code, const char *code_str, const char *content_type, const char *body, sc_headers *headers);
+/* Same as sc_easy_send, but the body is length-delimited, so it may hold binary data. */
+int sc_easy_send_n(int fd, int code, const char *code_str, const char *content_type, const char *body, size_t body_len, sc_headers *headers);
 char *sc_easy_request_build(int code, const char *code_str, const char *body, sc_headers *headers);
 int sc_easy_send2(int fd, int code, const char *code_str, const char *body, sc_headers *headers);
+/* Streamed responses. sc_stream_begin() sends the status line and headers of a chunked response (the headers list is
+ * freed), each sc_stream_chunk() sends one piece of the body, and sc_stream_end() finishes it. Inside a handler,
+ * a response that was begun and not ended or handed to a producer is ended when the handler returns. HTTP/1.0
+ * clients get the body unframed instead, and the connection is closed after it. */
+int sc_stream_begin(int fd, int code, const char *code_str, const char *content_type, sc_headers *headers);
+int sc_stream_chunk(int fd, const char *data, size_t len);
+int sc_stream_end(int fd);
+/* Hands the rest of a begun response to producer, which the loop calls after the handler returned, each time the
+ * socket took everything queued so far. It sends the next piece with sc_stream_chunk() and returns SC_CONTINUE,
+ * or SC_FINISHED once done (the response is then ended for it). Any other value aborts the response and closes the
+ * connection. If the connection closes first, the producer is called one last time with fd -1 to release ctx.
+ * The next pipelined requests are served once the producer finished. Only valid inside a handler. */
+int sc_stream_produce(int fd, int (*producer)(int, void *), void *ctx);
+
+/* serializes a full response into a single allocated buffer, returned in out. The headers list is not freed */
+int _sc_response_serialize(sc_str *out, int code, const char *code_str, const char *content_type,
+                           const char *body, size_t body_len, sc_headers *headers, bool keep_alive);
 
 struct _endpoint_list {
     sc_str val;
     void (*func)(int, sc_http_msg, sc_headers*);
     bool soft;
+    char *dir;              // directory served by sc_mgr_bind_static_dir(), NULL for handler endpoints
+    sc_str response;        // full response bound with sc_mgr_bind_static(), buf is NULL for other endpoints
+    sc_str response_close;  // the same with Connection: close, for the requests after which the connection closes
+    void (*body)(int, sc_http_msg, sc_headers*, sc_str);   // handler bound with sc_mgr_bind_body_*(), NULL otherwise
+    bool metrics;           // serves the metrics, see sc_mgr_metrics_enable()
+    int id;                 // index of its counters in the metrics of each loop
     struct _endpoint_list *next;
 };
 
 struct _endpoint_list *_endpoint_add(struct _endpoint_list *list, const char *endpoint, bool soft, void (*func)(int, sc_http_msg, sc_headers*));
+
+/* node of the compressed radix tree the endpoints are routed with. Labels are views into the endpoint strings,
+ * and children are sorted by the first byte of their label, which is also kept in child_keys. */
+struct _route_node {
+    sc_str label;
+    struct _endpoint_list *hard;    // endpoint bound to exactly the path ending at this node
+    struct _endpoint_list *soft;    // endpoint bound to the path ending at this node as a prefix
+    struct _route_node **children;
+    unsigned char *child_keys;
+    int child_count;
+    int child_cap;
+};
+
+int _sc_route_insert(struct _route_node **root, struct _endpoint_list *endpoint);
+/* returns the hard endpoint equal to the uri if there is one, and the longest matching soft endpoint otherwise */
+struct _endpoint_list *_sc_route_find(const struct _route_node *root, sc_str uri);
+void _sc_route_free(struct _route_node *node);
+
 int sc_mgr_bind_hard(sc_conn_mgr *mgr, const char *endpoint, void (*f)(int, sc_http_msg, sc_headers*));
 int sc_mgr_bind_soft(sc_conn_mgr *mgr, const char *endpoint, void (*f)(int, sc_http_msg, sc_headers*));
+int _sc_mgr_bind(sc_conn_mgr *mgr, const char *endpoint, bool soft, void (*f)(int, sc_http_msg, sc_headers*));
+
+/* Bind handlers that receive the request body. The handler is called for every piece of the body as it arrives,
+ * with chunk pointing into the connection buffer (only valid during the call), and once more with an empty chunk
+ * after the last one, which is when it should respond. Requests without a body only get that last call.
+ * If the body is cut short (the client left, it is too large or malformed), the last call has chunk.buf == NULL
+ * instead, so the handler can release what it kept; it must not respond then, as the connection is closed.
+ * Other handlers are called as soon as the head arrives, and the body of their requests is discarded. */
+int sc_mgr_bind_body_hard(sc_conn_mgr *mgr, const char *endpoint, void (*f)(int, sc_http_msg, sc_headers*, sc_str));
+int sc_mgr_bind_body_soft(sc_conn_mgr *mgr, const char *endpoint, void (*f)(int, sc_http_msg, sc_headers*, sc_str));
+
+/* Binds a response to exactly endpoint, which is serialized once here and sent as-is for every request to it,
+ * without calling any handler. Meant for health checks and other fixed answers. The headers list is freed. */
+int sc_mgr_bind_static(sc_conn_mgr *mgr, const char *endpoint, int code, const char *code_str,
+                       const char *content_type, const char *body, sc_headers *headers);
+
+/* Serves the files under dir for every GET and HEAD request starting with endpoint (as a soft bind).
+ * The rest of the uri is the path of the file, with "index.html" added for directories. Bodies are sent with
+ * sendfile(), and the open fds and file sizes are cached per loop, checked again once SC_FILE_CACHE_TTL passes. */
+int sc_mgr_bind_static_dir(sc_conn_mgr *mgr, const char *endpoint, const char *dir);
+
+// static files (internal)
+
+struct _sc_file *_sc_file_cache_get(sc_conn_mgr *mgr, const char *path);
+void _sc_file_cache_destroy(sc_conn_mgr *mgr);
+void _sc_file_put(struct _sc_file *file);
+int _sc_file_send(sc_conn *conn);
+int _sc_static_serve(sc_conn_mgr *mgr, sc_conn *conn, struct _endpoint_list *endpoint);
 
 
 
@@ -190,8 +812,21 @@ int sc_mgr_bind_soft(sc_conn_mgr *mgr, const char *endpoint, void (*f)(int, sc_h
 
 // logging
 
-void sc_log(sc_conn_mgr *mgr, int ll, const char *format, ...);
-void sc_error_log(sc_conn_mgr *mgr, int ll, const char *format, ...);
-void sc_perror(sc_conn_mgr *mgr, int ll, const char *format);
+/* Log a message if ll is within the level of the manager (sc_mgr_ll_set(), SC_LL_NORMAL by default).
+ * Messages are formatted into a ring buffer, which a background thread writes to stdout or stderr, so the event
+ * loop never waits on the terminal. Messages longer than SC_LOG_RECORD_SIZE are truncated. */
+#define sc_log(mgr, ll, ...) \
+    do { if ((ll) <= SC_LOG_LEVEL_MAX) _sc_log(mgr, ll, STDOUT_FILENO, __VA_ARGS__); } while (0)
+#define sc_error_log(mgr, ll, ...) \
+    do { if ((ll) <= SC_LOG_LEVEL_MAX) _sc_log(mgr, ll, STDERR_FILENO, __VA_ARGS__); } while (0)
+/* like perror(), the message is followed by the description of errno */
+#define sc_perror(mgr, ll, err) \
+    do { if ((ll) <= SC_LOG_LEVEL_MAX) _sc_perror(mgr, ll, err); } while (0)
+
+void _sc_log(sc_conn_mgr *mgr, int ll, int fd, const char *format, ...) __attribute__((format(printf, 4, 5)));
+void _sc_perror(sc_conn_mgr *mgr, int ll, const char *err);
+/* the flush thread runs while a manager exists; without it, messages are written synchronously */
+void _sc_log_start(void);
+void _sc_log_stop(void);
 
 #endif // SCULPT_H
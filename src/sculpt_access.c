@@ -0,0 +1,352 @@
+#include "sculpt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+
+#include <sys/mman.h>
+
+#define ACCESS_HEADER_SIZE sizeof(sc_access_log_header)
+
+_Static_assert(sizeof(sc_access_log_header) == 64, "the access log header must stay 64 bytes");
+_Static_assert(sizeof(sc_access_entry) == 64, "access log entries must stay 64 bytes");
+
+/* access log file of one loop. The whole file is mapped, entries are appended from the start and URIs from the end,
+ * and it is rotated when they meet */
+struct _sc_access_log {
+    char *path;
+    int fd;
+    char *map;
+    size_t size;
+    size_t entries_end;         // offset after the last entry
+    size_t strings_start;       // offset of the lowest URI
+    uint32_t generation;        // bumped on rotation
+    struct {
+        uint32_t hash;
+        uint32_t off;           // 0 if the slot is empty
+    } uris[SC_ACCESS_LOG_URI_CACHE];    // recently stored URIs, so each one is written once per file
+};
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static uint32_t elapsed_us(uint64_t from, uint64_t to) {
+    uint64_t us = (to - from) / 1000;
+    return us >= UINT32_MAX ? UINT32_MAX - 1 : (uint32_t) us;
+}
+
+static uint32_t uri_hash(sc_str uri) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < uri.len; i++) {
+        hash = (hash ^ (unsigned char) uri.buf[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static void log_unmap(struct _sc_access_log *log) {
+    if (log->map != NULL) {
+        munmap(log->map, log->size);
+        log->map = NULL;
+    }
+    if (log->fd >= 0) {
+        close(log->fd);
+        log->fd = -1;
+    }
+}
+
+// moves the current file to path.old and starts an empty one. The file is sparse, only the pages written to use space
+static int log_open(struct _sc_access_log *log) {
+    char old[PATH_MAX];
+    int len = snprintf(old, sizeof(old), "%s.old", log->path);
+    if (len < 0 || (size_t) len >= sizeof(old)) {
+        return SC_BUFFER_OVERFLOW_ERR;
+    }
+    if (rename(log->path, old) == -1 && errno != ENOENT) {
+        return SC_BAD_ARGUMENTS_ERR;
+    }
+
+    log->fd = open(log->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (log->fd == -1) {
+        return SC_BAD_ARGUMENTS_ERR;
+    }
+    if (ftruncate(log->fd, log->size) == -1) {
+        log_unmap(log);
+        return SC_BAD_ARGUMENTS_ERR;
+    }
+
+    log->map = mmap(NULL, log->size, PROT_READ | PROT_WRITE, MAP_SHARED, log->fd, 0);
+    if (log->map == MAP_FAILED) {
+        log->map = NULL;
+        log_unmap(log);
+        return SC_MALLOC_ERR;
+    }
+
+    sc_access_log_header *header = (sc_access_log_header *) log->map;
+    header->magic = SC_ACCESS_LOG_MAGIC;
+    header->version = SC_ACCESS_LOG_VERSION;
+    header->entry_size = sizeof(sc_access_entry);
+    header->entry_count = 0;
+    header->size = log->size;
+    header->strings_start = log->size;
+
+    log->entries_end = ACCESS_HEADER_SIZE;
+    log->strings_start = log->size;
+    log->generation++;
+    memset(log->uris, 0, sizeof(log->uris));
+    return SC_OK;
+}
+
+static struct _sc_access_log *log_create(const char *path, size_t max_size, int *err) {
+    struct _sc_access_log *log = calloc(1, sizeof(struct _sc_access_log));
+    if (log == NULL) {
+        *err = SC_MALLOC_ERR;
+        return NULL;
+    }
+    log->fd = -1;
+    log->size = max_size;
+    log->path = strdup(path);
+    if (log->path == NULL) {
+        free(log);
+        *err = SC_MALLOC_ERR;
+        return NULL;
+    }
+
+    *err = log_open(log);
+    if (*err != SC_OK) {
+        free(log->path);
+        free(log);
+        return NULL;
+    }
+    return log;
+}
+
+struct _sc_access_log *_sc_access_log_worker(sc_conn_mgr *mgr, int index, int *err) {
+    char path[PATH_MAX];
+    int len = snprintf(path, sizeof(path), "%s.%d", mgr->access_log->path, index);
+    if (len < 0 || (size_t) len >= sizeof(path)) {
+        *err = SC_BUFFER_OVERFLOW_ERR;
+        return NULL;
+    }
+    return log_create(path, mgr->access_log->size, err);
+}
+
+void _sc_access_log_destroy(sc_conn_mgr *mgr) {
+    struct _sc_access_log *log = mgr->access_log;
+    if (log == NULL) return;
+
+    log_unmap(log);
+    free(log->path);
+    free(log);
+    mgr->access_log = NULL;
+}
+
+int sc_mgr_access_log_enable(sc_conn_mgr *mgr, const char *path, size_t max_size) {
+    if (mgr == NULL || path == NULL || mgr->parent != NULL || mgr->worker_count > 0) return SC_BAD_ARGUMENTS_ERR;
+    if (max_size == 0) {
+        max_size = SC_DEFAULT_ACCESS_LOG_SIZE;
+    }
+    // URI offsets are 32 bit
+    if (max_size < SC_ACCESS_LOG_MIN_SIZE || max_size > UINT32_MAX) return SC_BAD_ARGUMENTS_ERR;
+
+    int err;
+    struct _sc_access_log *log = log_create(path, max_size, &err);
+    if (log == NULL) {
+        sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error: failed to open the access log");
+        return err;
+    }
+
+    _sc_access_log_destroy(mgr);
+    mgr->access_log = log;
+    return SC_OK;
+}
+
+// returns the offset of the URI in the file, storing it unless it is in the cache. 0 if it doesn't fit
+static uint32_t uri_store(struct _sc_access_log *log, sc_str uri, uint32_t hash) {
+    if (uri.len > UINT16_MAX) {
+        uri.len = UINT16_MAX;
+    }
+
+    int slot = hash % SC_ACCESS_LOG_URI_CACHE;
+    uint32_t off = log->uris[slot].off;
+    if (off != 0 && log->uris[slot].hash == hash) {
+        uint16_t len;
+        memcpy(&len, log->map + off, sizeof(len));
+        if (len == uri.len && memcmp(log->map + off + sizeof(len), uri.buf, uri.len) == 0) {
+            return off;
+        }
+    }
+
+    size_t need = sizeof(uint16_t) + uri.len;
+    if (log->strings_start - log->entries_end < need + sizeof(sc_access_entry)) {
+        return 0;
+    }
+
+    log->strings_start -= need;
+    uint16_t len = uri.len;
+    memcpy(log->map + log->strings_start, &len, sizeof(len));
+    memcpy(log->map + log->strings_start + sizeof(len), uri.buf, uri.len);
+    ((sc_access_log_header *) log->map)->strings_start = log->strings_start;
+
+    log->uris[slot].hash = hash;
+    log->uris[slot].off = log->strings_start;
+    return log->strings_start;
+}
+
+// appends an empty entry, rotating the file when it is full. Returns NULL if the file couldn't be replaced
+static sc_access_entry *entry_append(sc_conn_mgr *mgr, struct _sc_access_log *log, sc_str uri, uint32_t hash,
+                                     uint32_t *uri_off) {
+    *uri_off = 0;
+    if (log->map != NULL && uri.len > 0) {
+        *uri_off = uri_store(log, uri, hash);
+    }
+
+    if (log->map == NULL || (uri.len > 0 && *uri_off == 0)
+        || log->strings_start - log->entries_end < sizeof(sc_access_entry)) {
+        log_unmap(log);
+        if (log_open(log) != SC_OK) {
+            sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Error rotating the access log");
+            return NULL;
+        }
+        if (uri.len > 0) {
+            *uri_off = uri_store(log, uri, hash);
+        }
+    }
+
+    sc_access_entry *entry = (sc_access_entry *) (log->map + log->entries_end);
+    log->entries_end += sizeof(sc_access_entry);
+    return entry;
+}
+
+static sc_access_entry *entry_at(struct _sc_access_log *log, uint32_t index) {
+    return (sc_access_entry *) (log->map + ACCESS_HEADER_SIZE + (size_t) index * sizeof(sc_access_entry));
+}
+
+void _sc_access_begin(sc_conn_mgr *mgr, sc_conn *conn) {
+    (void) mgr;
+    if (conn->access.start != 0 || conn->rbuf_len == 0) return;
+
+    conn->access.start = clock_ns(CLOCK_MONOTONIC);
+    conn->access.real = clock_ns(CLOCK_REALTIME);
+    conn->access.parsed = 0;
+    conn->access.out_start = conn->out_bytes;
+    conn->access.status = 0;
+}
+
+void _sc_access_parsed(sc_conn_mgr *mgr, sc_conn *conn) {
+    (void) mgr;
+    conn->access.parsed = clock_ns(CLOCK_MONOTONIC);
+}
+
+void _sc_access_status(sc_conn *conn, sc_str response) {
+    // "HTTP/1.1 200 ..."
+    if (response.len < 12) return;
+    const char *code = response.buf + 9;
+    conn->access.status = (code[0] - '0') * 100 + (code[1] - '0') * 10 + (code[2] - '0');
+}
+
+// writes the log entry of a finished request, and sets index to its position in the file
+static bool entry_write(sc_conn_mgr *mgr, sc_conn *conn, uint64_t start, uint64_t parsed, uint64_t now, uint32_t *index) {
+    struct _sc_access_log *log = mgr->access_log;
+    struct _sc_access_req *req = &conn->access;
+    sc_http_msg msg = conn->parser.state == SC_PARSE_REQUEST_LINE ? (sc_http_msg) {0} : conn->parser.msg;
+    uint32_t hash = uri_hash(msg.uri);
+
+    uint32_t uri_off;
+    sc_access_entry *entry = entry_append(mgr, log, msg.uri, hash, &uri_off);
+    if (entry == NULL) return false;
+
+    *entry = (sc_access_entry) {
+        .time = req->real,
+        .bytes = conn->out_bytes - req->out_start,
+        .port = ntohs(conn->peer.sin_port),
+        .status = req->status,
+        .uri_hash = hash,
+        .uri_off = uri_off,
+        .parse_us = elapsed_us(start, parsed),
+        .handler_us = elapsed_us(parsed, now),
+        .send_us = UINT32_MAX,
+    };
+    entry->addr[10] = 0xff;
+    entry->addr[11] = 0xff;
+    memcpy(&entry->addr[12], &conn->peer.sin_addr.s_addr, 4);
+    if (msg.method.buf != NULL) {
+        memcpy(entry->method, msg.method.buf, msg.method.len < sizeof(entry->method) ? msg.method.len : sizeof(entry->method));
+    }
+
+    sc_access_log_header *header = (sc_access_log_header *) log->map;
+    *index = header->entry_count;
+    __atomic_store_n(&header->entry_count, *index + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+// records the send time of a request whose response the socket took, or that never will be sent
+static void pending_close(sc_conn_mgr *mgr, sc_conn *conn, int i, uint32_t send_us, bool last) {
+    struct _sc_access_log *log = mgr->access_log;
+    struct _sc_access_req *req = &conn->access;
+
+    // a response ends where the one of the next request starts. The last one may still have been streamed by a
+    // producer after its request was done
+    uint64_t end = last ? conn->out_bytes : req->pending[i + 1].out_start;
+    uint64_t bytes = end - req->pending[i].out_start;
+
+    if (log != NULL && req->pending[i].generation == log->generation) {
+        sc_access_entry *entry = entry_at(log, req->pending[i].index);
+        entry->send_us = send_us;
+        entry->bytes = bytes;
+    }
+    if (mgr->metrics != NULL) {
+        _sc_metrics_sent(mgr, req->pending[i].endpoint, send_us, bytes);
+    }
+}
+
+void _sc_access_end(sc_conn_mgr *mgr, sc_conn *conn) {
+    struct _sc_access_log *log = mgr->access_log;
+    struct _sc_access_req *req = &conn->access;
+    if (req->start == 0) return;
+
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    uint64_t start = req->start;
+    uint64_t parsed = req->parsed != 0 ? req->parsed : now;
+    req->start = 0;
+
+    uint32_t index = 0;
+    if (log != NULL && !entry_write(mgr, conn, start, parsed, now, &index)) {
+        log = NULL;
+    }
+    if (mgr->metrics != NULL) {
+        _sc_metrics_request(mgr, conn, elapsed_us(start, parsed), elapsed_us(parsed, now));
+    }
+
+    // its send time is known once the socket took everything queued so far. A client pipelining more requests than
+    // that without reading the responses gets the oldest one closed now
+    if (req->pending_count == SC_ACCESS_LOG_PENDING) {
+        pending_close(mgr, conn, 0, elapsed_us(req->pending[0].done, now), false);
+        memmove(&req->pending[0], &req->pending[1], (SC_ACCESS_LOG_PENDING - 1) * sizeof(req->pending[0]));
+        req->pending_count--;
+    }
+    req->pending[req->pending_count].index = index;
+    req->pending[req->pending_count].generation = log != NULL ? log->generation : 0;
+    req->pending[req->pending_count].done = now;
+    req->pending[req->pending_count].out_start = req->out_start;
+    req->pending[req->pending_count].endpoint = conn->parser.route != NULL ? conn->parser.route->id : -1;
+    req->pending_count++;
+}
+
+void _sc_access_sent(sc_conn_mgr *mgr, sc_conn *conn, bool complete) {
+    struct _sc_access_req *req = &conn->access;
+    if (req->pending_count == 0) return;
+
+    uint64_t now = clock_ns(CLOCK_MONOTONIC);
+    for (int i = 0; i < req->pending_count; i++) {
+        uint32_t send_us = complete ? elapsed_us(req->pending[i].done, now) : UINT32_MAX;
+        pending_close(mgr, conn, i, send_us, i == req->pending_count - 1);
+    }
+    req->pending_count = 0;
+}
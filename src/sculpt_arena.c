@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sculpt.h"
+
+#define ARENA_ALIGN (_Alignof(max_align_t))
+
+struct _sc_arena_block {
+    struct _sc_arena_block *next;
+    size_t cap;
+    _Alignas(max_align_t) char data[];
+};
+
+static struct _sc_arena_block *block_create(size_t cap, struct _sc_arena_block *next) {
+    struct _sc_arena_block *block = malloc(sizeof(struct _sc_arena_block) + cap);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = next;
+    block->cap = cap;
+    return block;
+}
+
+void *_sc_arena_alloc(struct _sc_arena *arena, size_t size) {
+    if (size == 0) {
+        size = 1;
+    }
+    if (size > SIZE_MAX - ARENA_ALIGN) {
+        return NULL;
+    }
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+    if ((size_t) (arena->end - arena->ptr) < size) {
+        // the first block is kept for the next requests; the ones added when it runs out only live for this one,
+        // each at least twice as large as the last so a big request doesn't end up with a long list
+        size_t cap = SC_ARENA_BLOCK_SIZE;
+        if (arena->blocks != NULL) {
+            cap = arena->blocks->cap * 2;
+        }
+        if (cap < size) {
+            cap = size;
+        }
+
+        struct _sc_arena_block *block = block_create(cap, arena->blocks);
+        if (block == NULL) {
+            return NULL;
+        }
+        if (arena->base == NULL) {
+            arena->base = block;
+        }
+        arena->blocks = block;
+        arena->ptr = block->data;
+        arena->end = block->data + cap;
+    }
+
+    void *mem = arena->ptr;
+    arena->ptr += size;
+    return mem;
+}
+
+void _sc_arena_reset(struct _sc_arena *arena) {
+    while (arena->blocks != arena->base) {
+        struct _sc_arena_block *next = arena->blocks->next;
+        free(arena->blocks);
+        arena->blocks = next;
+    }
+
+    if (arena->base != NULL) {
+        arena->ptr = arena->base->data;
+        arena->end = arena->base->data + arena->base->cap;
+    }
+}
+
+void _sc_arena_free(struct _sc_arena *arena) {
+    _sc_arena_reset(arena);
+    free(arena->base);
+    *arena = (struct _sc_arena) {0};
+}
+
+void *sc_req_alloc(int fd, size_t size) {
+    sc_conn *conn = _sc_conn_current(fd);
+    if (conn == NULL) {
+        return NULL;
+    }
+    return _sc_arena_alloc(&conn->arena, size);
+}
@@ -1,3 +1,5 @@
+#include "sculpt.h"
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,419 +12,939 @@
 #include <unistd.h>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <netinet/in.h>
 
-#include "sculpt.h"
-
 #define RETURN_ERROR_IF(condition, error_code, message) \
     do { \
         if (condition) { \
-            perror(message); \
+            sc_perror(mgr, SC_LL_MINIMAL, message); \
             return error_code; \
         } \
     } while (0)
 
-#define SC_HEADER_PARSE_ERR -256
-#define SC_HEADER_PARSE_INCOMPLETE_ERR -257
-
 int sc_mgr_epoll_init(sc_conn_mgr *mgr) {
     RETURN_ERROR_IF(!mgr, SC_BAD_ARGUMENTS_ERR, "[Sculpt] NULL manager provided");
 
-    // using EPOLL_CLOEXEC to prevent fd leaks across exec()
-    mgr->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
-    RETURN_ERROR_IF(mgr->epoll_fd == -1, SC_EPOLL_CREATION_ERR, "[Sculpt] epoll_create1 failed");
-
     int flags = fcntl(mgr->fd, F_GETFL);
     RETURN_ERROR_IF(flags == -1, SC_FCNTL_ERR, "[Sculpt] Failed to get socket flags");
     
     RETURN_ERROR_IF(fcntl(mgr->fd, F_SETFL, flags | O_NONBLOCK) == -1,
                    SC_FCNTL_ERR, "[Sculpt] Failed to set non-blocking mode");
 
-    mgr->epoll_event.events = EPOLLIN | EPOLLRDHUP; // no edge triggered mode
+    if (mgr->backend == SC_BACKEND_IO_URING) {
+        if (_sc_uring_init(mgr) == SC_OK) return SC_OK;
+        sc_error_log(mgr, SC_LL_MINIMAL, "[Sculpt] io_uring is not available, using epoll\n");
+        mgr->backend = SC_BACKEND_EPOLL;
+    }
+
+    // using EPOLL_CLOEXEC to prevent fd leaks across exec()
+    mgr->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    RETURN_ERROR_IF(mgr->epoll_fd == -1, SC_EPOLL_CREATION_ERR, "[Sculpt] epoll_create1 failed");
+
+    mgr->epoll_event.events = EPOLLIN | EPOLLRDHUP | (mgr->listener_et ? EPOLLET : 0);
     mgr->epoll_event.data.fd = mgr->fd;
     RETURN_ERROR_IF(epoll_ctl(mgr->epoll_fd, EPOLL_CTL_ADD, mgr->fd, &mgr->epoll_event) == -1,
                    SC_EPOLL_CTL_ERR, "[Sculpt] epoll_ctl failed");
 
+    // the connections the old process passes while it drains, see sc_mgr_takeover()
+    int prev_fd = _sc_handoff_prev_fd(mgr);
+    if (prev_fd >= 0) {
+        struct epoll_event event = {.events = EPOLLIN, .data.fd = prev_fd};
+        RETURN_ERROR_IF(epoll_ctl(mgr->epoll_fd, EPOLL_CTL_ADD, prev_fd, &event) == -1,
+                       SC_EPOLL_CTL_ERR, "[Sculpt] epoll_ctl failed for the handoff socket");
+    }
+
     mgr->events = calloc(mgr->max_events, sizeof(struct epoll_event)); 
     RETURN_ERROR_IF(!mgr->events, SC_MALLOC_ERR, "[Sculpt] Failed to allocate events array");return SC_OK;
 }
 
+static int accept_error(sc_conn_mgr *mgr) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // the accept queue is empty
+        return SC_FINISHED;
+    }
+    if (errno == EINTR || errno == ECONNABORTED || errno == EPROTO) {
+        // only this client is affected, keep accepting
+        return SC_CONTINUE;
+    }
+    sc_error_log(mgr, SC_LL_MINIMAL, "[Sculpt] Fatal: Accept error: %d\n", errno);
+    return SC_ACCEPT_ERR;
+}
+
+static int conn_watch(sc_conn_mgr *mgr, sc_conn *conn) {
+    struct epoll_event event = {
+        .events = EPOLLIN | EPOLLRDHUP, // no edge triggered mode, so no re-arming is needed after each request
+        .data.ptr = conn
+    };
+    conn->events = event.events;
+
+    // add the event to epoll 
+    if (epoll_ctl(mgr->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event) == -1) {
+        sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Failed to add connection to epoll");
+        close(conn->fd);
+        sc_mgr_conn_release(mgr, conn);
+        return SC_CONTINUE;
+    }
+    return SC_OK;
+}
+
+// accepts a single client. Returns SC_FINISHED once the accept queue is empty.
 static int create_new_connection(sc_conn_mgr *mgr) {
-    fprintf(stdout, "[Sculpt] Creating new connection\n");
-    socklen_t addr_len = sizeof(mgr->addr_info._sock_addr);
-
-    // new connection, check capacity before proceeding
-    if (mgr->conn_count >= mgr->max_conn_count) {
-        perror("[Sculpt] No avaliable connections found! Sending 503 response");
-        int client_fd = accept(mgr->fd, (struct sockaddr*)&mgr->addr_info._sock_addr, &addr_len);
-        if (client_fd != -1) {
-             static const char *msg = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 21\r\n\r\nServer at capacity\r\n";
-            send(client_fd, msg, strlen(msg), MSG_NOSIGNAL);
-            close(client_fd);
+    // new connection, check capacity and load before proceeding
+    bool full = mgr->conn_count >= mgr->max_conn_count;
+    if (full || (mgr->shed_mode == SC_SHED_REJECT && !_sc_overload_admit(mgr, 0))) {
+        int client_fd = accept4(mgr->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            return accept_error(mgr);
         }
+
+        if (full) {
+            sc_error_log(mgr, SC_LL_NORMAL, "[Sculpt] No avaliable connections found! Sending 503 response\n");
+            _SC_STAT_ADD(mgr->stats.rejected, 1);
+        } else {
+            _SC_STAT_ADD(mgr->stats.shed, 1);
+        }
+        send(client_fd, mgr->response_503.buf, mgr->response_503.len, MSG_NOSIGNAL);
+        close(client_fd);
         return SC_CONTINUE;
     }
 
     // try to find an unused connection
     sc_conn *conn = sc_mgr_conn_get_free(mgr);
     if (!conn) {
-        perror("[Sculpt] Failed to find free connection on sc_mgr_conn_get_free()\n");
-        return SC_CONTINUE;
+        sc_error_log(mgr, SC_LL_NORMAL, "[Sculpt] Failed to find free connection on sc_mgr_conn_get_free()\n");
+        return SC_FINISHED;
     }
 
-    // valid connection was found, so we accept the request
-     conn->fd = accept(mgr->fd, (struct sockaddr*)&mgr->addr_info._sock_addr, &addr_len);
-
+    // valid connection was found, so we accept the request. accept4 sets non-blocking mode in the same syscall
+    socklen_t peer_len = sizeof(conn->peer);
+    conn->fd = accept4(mgr->fd, (struct sockaddr *) &conn->peer, &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if (conn->fd == -1) {
-        perror("[Sculpt] Error on Accept. Checking severity\n");
         sc_mgr_conn_release(mgr, conn);
-        if (errno != EAGAIN && errno != EWOULDBLOCK) { // if the error is not because it would block or cuz it is unacailable, we don't return the function
-            fprintf(stderr, "[Sculpt] Fatal: Accept error: %d\n", errno);
-            return SC_ACCEPT_ERR;
-        }
-        return SC_CONTINUE;
+        return accept_error(mgr);
     }
+    sc_log(mgr, SC_LL_DEBUG, "[Sculpt] Created new connection\n");
+    _SC_STAT_ADD(mgr->stats.accepted, 1);
+    mgr->admitted++;
 
-    // set connection as non-blocking because we used accept instead of accept4
-    if (fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK) == -1) {
-        perror("Error setting non-blocking mode");
-        sc_mgr_conn_release(mgr, conn);
-        close(conn->fd);
-        return SC_CONTINUE;
-    }  
+    return conn_watch(mgr, conn);
+}
 
-    struct epoll_event event = {
-        .events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT, // no edge triggered mode
-        .data.ptr = conn
-    };
+int _sc_conn_adopt(sc_conn_mgr *mgr, int fd) {
+    sc_conn *conn = sc_mgr_conn_get_free(mgr);
+    if (conn == NULL) {
+        sc_error_log(mgr, SC_LL_NORMAL, "[Sculpt] No room for a connection of the previous server, closing it\n");
+        close(fd);
+        return SC_MALLOC_ERR;
+    }
+    conn->fd = fd;
+    socklen_t peer_len = sizeof(conn->peer);
+    getpeername(fd, (struct sockaddr *) &conn->peer, &peer_len);
+    sc_log(mgr, SC_LL_DEBUG, "[Sculpt] Adopted a connection of the previous server\n");
+
+    if (mgr->uring != NULL) {
+        _sc_uring_open(mgr, conn);
+        return SC_OK;
+    }
+    return conn_watch(mgr, conn);
+}
 
-    // add the event to epoll 
-    if (epoll_ctl(mgr->epoll_fd, EPOLL_CTL_ADD, conn->fd, &event) == -1) {
-        perror("[Sculpt] Failed to add connection to epoll");
-        sc_mgr_conn_release(mgr, conn);
-        close(conn->fd);
-        return SC_CONTINUE;
+// drains the accept queue, accepting at most accept_budget clients so a connection storm can't starve the
+// connections that are already open
+static int accept_connections(sc_conn_mgr *mgr) {
+    for (int i = 0; i < mgr->accept_budget; i++) {
+        // a deferring loop leaves the clients it can't serve in time in the accept queue, the listening socket
+        // is reported again with the next batch
+        if (mgr->shed_mode == SC_SHED_DEFER && !_sc_overload_admit(mgr, 0)) break;
+
+        int rc = create_new_connection(mgr);
+        if (rc == SC_FINISHED) {
+            mgr->accept_pending = false;
+            return SC_OK;
+        }
+        if (rc != SC_OK && rc != SC_CONTINUE) {
+            return rc;
+        }
     }
+
+    // an edge-triggered listener won't be reported again for the clients still waiting in the queue
+    mgr->accept_pending = mgr->listener_et;
     return SC_OK;
 }
 
-static void return_500(sc_conn_mgr *mgr, sc_conn *conn) {
-     const char *http_response_500 = 
-        "HTTP/1.1 500 Internal Server Error\r\n"
-        "Content-Type: text/html; charset=UTF-8\r\n"
-        "Content-Length: 21\r\n"
-        "\r\n"
-        "Internal Server Error";
+// the connection being served by the handler running on this thread
+static __thread sc_conn *current_conn = NULL;
 
-     send(conn->fd, http_response_500, strlen(http_response_500), 0);
-     close(conn->fd);
-     sc_mgr_conn_release(mgr, conn);                    
-     epoll_ctl(mgr->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+bool _sc_conn_keep_alive(const sc_conn *conn) {
+    return conn->parser.keep_alive && !conn->closing;
 }
 
-void cleanup_after_error(sc_conn_mgr *mgr, sc_conn *conn) {
-    if (conn) {
-        return_500(mgr, conn);
-        sc_mgr_conn_release(mgr, conn);
-        close(conn->fd);
-        epoll_ctl(mgr->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+sc_conn *_sc_conn_current(int fd) {
+    if (current_conn != NULL && current_conn->fd == fd) {
+        return current_conn;
     }
+    return NULL;
 }
 
-int next_header(int fd, char *header, size_t buf_len) {
-    header[0] = '\0';
-    size_t header_len = 0;
-    char last_char = '\0';
+int _sc_conn_write(sc_conn *conn, const char *data, size_t len) {
+    if (conn->wbuf_len + len > conn->wbuf_cap) {
+        // reclaim the space of what was already sent before growing
+        if (conn->wbuf_off > 0) {
+            memmove(conn->wbuf, conn->wbuf + conn->wbuf_off, conn->wbuf_len - conn->wbuf_off);
+            conn->wbuf_len -= conn->wbuf_off;
+            conn->wbuf_off = 0;
+        }
 
-    while (1) {
-        if (header_len >= buf_len - 1) { // stop if the header is larger than the buffer
-            return SC_BUFFER_OVERFLOW_ERR;
+        size_t cap = conn->wbuf_cap ? conn->wbuf_cap : SC_CONN_WRITE_BUF_SIZE;
+        while (cap < conn->wbuf_len + len) {
+            cap *= 2;
         }
 
-        ssize_t bytes_read = read(fd, &header[header_len], 1);
-        if (bytes_read > 0) {
-            if (last_char == '\r' && header[header_len] == '\n') {
-                // we got to the end of the header
-                header[header_len - 1] = '\0';
-                header_len --;
-                break;
-            }
-            last_char = header[header_len];
-            header_len++;
-            header[header_len] = '\0';        
-        } else if (bytes_read == -1) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                // no more data to read, break out of loop
-                break;
+        if (cap > conn->wbuf_cap) {
+            char *wbuf = realloc(conn->wbuf, cap);
+            if (wbuf == NULL) {
+                return SC_MALLOC_ERR;
             }
-            // an actual error occoured
-            perror("[Sculpt] Error reading body from client");
-            return SC_READ_ERR;
-        } else if (bytes_read == 0) {
-            // EOF e or client closed the connection
-            if (header_len > 0) {
-                // we still have some header data read, but EOF is reached
-                return SC_OK; 
-            }
-            return SC_FINISHED;
+            conn->wbuf = wbuf;
+            conn->wbuf_cap = cap;
         }
     }
 
-    if (header[0] == '\0') { // the header is empty, that is, we have reached the end of the headers
-        return SC_FINISHED;
+    memcpy(conn->wbuf + conn->wbuf_len, data, len);
+    conn->wbuf_len += len;
+    conn->out_bytes += len;
+    return SC_OK;
+}
+
+size_t _sc_conn_pending(const sc_conn *conn) {
+    size_t pending = conn->wbuf_len - conn->wbuf_off + conn->uring.sbuf_len - conn->uring.sbuf_off;
+    if (conn->file != NULL) {
+        pending += conn->file_end - conn->file_off;
+    }
+    return pending;
+}
+
+int _sc_conn_writev(sc_conn *conn, const struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+
+    // small responses are copied, so all the responses of one event go out in a single send.
+    // nothing can be written directly while a file body is still being sent, as it must go out first, and with
+    // io_uring a send of the queue may be in flight
+    if (total <= SC_CONN_COALESCE_MAX || iovcnt >= IOV_MAX || conn->file != NULL || conn->uring.active) {
+        for (int i = 0; i < iovcnt; i++) {
+            int rc = _sc_conn_write(conn, iov[i].iov_base, iov[i].iov_len);
+            if (rc != SC_OK) return rc;
+        }
+        return SC_OK;
+    }
+
+    // large responses are written straight from the caller's memory, in the same writev as the queued data
+    struct iovec vec[iovcnt + 1];
+    vec[0] = (struct iovec) {conn->wbuf + conn->wbuf_off, conn->wbuf_len - conn->wbuf_off};
+    memcpy(&vec[1], iov, iovcnt * sizeof(struct iovec));
+
+    ssize_t n;
+    do {
+        // sendmsg() rather than writev(), so a client that reset the connection doesn't raise SIGPIPE
+        n = sendmsg(conn->fd, &(struct msghdr) {.msg_iov = vec, .msg_iovlen = iovcnt + 1}, MSG_NOSIGNAL);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            return SC_SEND_ERR;
+        }
+        n = 0;
     }
 
+    // drop what was sent, and keep the rest queued in order
+    size_t sent = n;
+    size_t queued = vec[0].iov_len;
+    if (sent >= queued) {
+        conn->wbuf_off = 0;
+        conn->wbuf_len = 0;
+        sent -= queued;
+        conn->out_bytes += sent;
+    } else {
+        conn->wbuf_off += sent;
+        sent = 0;
+    }
+
+    for (int i = 0; i < iovcnt; i++) {
+        if (sent >= iov[i].iov_len) {
+            sent -= iov[i].iov_len;
+            continue;
+        }
+        int rc = _sc_conn_write(conn, (const char *) iov[i].iov_base + sent, iov[i].iov_len - sent);
+        if (rc != SC_OK) return rc;
+        sent = 0;
+    }
     return SC_OK;
 }
 
-int get_http_msg(char *header, sc_http_msg *http_msg) {
-    if (http_msg == NULL) {
-        return SC_BAD_ARGUMENTS_ERR;
+int _sc_conn_flush(sc_conn_mgr *mgr, sc_conn *conn) {
+    if (conn->uring.active) {
+        return _sc_uring_flush(mgr, conn);
     }
-    if (header == NULL) {
-        return SC_BAD_ARGUMENTS_ERR;
-    }    
-    
-    const char *space = strchr(header, ' ');
-    if (space == NULL) {
-        return SC_MALFORMED_HEADER_ERR;
+
+    while (conn->wbuf_off < conn->wbuf_len) {
+        ssize_t n = send(conn->fd, conn->wbuf + conn->wbuf_off, conn->wbuf_len - conn->wbuf_off, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn->wbuf_off += n;
+            continue;
+        }
+        if (n == -1 && errno == EINTR) continue;
+
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            // the rest stays queued until the socket reports EPOLLOUT
+            return SC_PENDING;
+        }
+        sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Error sending response");
+        return SC_SEND_ERR;
     }
-    
-    // find method in header
-    size_t method_len = space - header;
-    if (method_len == 0 || method_len > METHOD_BUF_SIZE) {
-        return SC_BUFFER_OVERFLOW_ERR;
+
+    conn->wbuf_off = 0;
+    conn->wbuf_len = 0;
+
+    // a static file body follows the headers queued before it
+    if (conn->file != NULL) {
+        int rc = _sc_file_send(conn);
+        if (rc == SC_SEND_ERR) {
+            sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Error sending file");
+        }
+        return rc;
+    }
+    return SC_OK;
+}
+
+static void return_error(sc_conn *conn, sc_str response) {
+     // the responses to earlier pipelined requests go out before the error, and the connection is closed
+     // once everything was written
+     _sc_conn_write(conn, response.buf, response.len);
+     _sc_access_status(conn, response);
+     conn->closing = true;
+}
+
+// calls the body handler of the request with one chunk of its body. Bodies of other endpoints are discarded
+static void deliver_body(sc_conn *conn, sc_str chunk) {
+    struct _endpoint_list *route = conn->parser.route;
+    if (route == NULL || route->body == NULL) return;
+
+    current_conn = conn;
+    route->body(conn->fd, conn->parser.msg, _sc_request_headers(conn), chunk);
+    current_conn = NULL;
+}
+
+// ends a streamed response the handler left open, unless it was handed to a producer
+static void stream_finish(sc_conn_mgr *mgr, sc_conn *conn) {
+    if (!conn->streaming || conn->producer != NULL) return;
+
+    sc_log(mgr, SC_LL_DEBUG, "[Sculpt] Ending the response stream left open by the handler\n");
+    current_conn = conn;
+    sc_stream_end(conn->fd);
+    current_conn = NULL;
+}
+
+// asks the producer for the next piece of the streamed response
+static void stream_produce(sc_conn_mgr *mgr, sc_conn *conn) {
+    current_conn = conn;
+    int rc = conn->producer(conn->fd, conn->producer_ctx);
+    if (rc == SC_FINISHED) {
+        sc_stream_end(conn->fd);
+    }
+    current_conn = NULL;
+    if (rc == SC_CONTINUE) return;
+
+    conn->producer = NULL;
+    conn->producer_ctx = NULL;
+    if (conn->parser.state == SC_PARSE_REQUEST_LINE) {
+        // the request was already consumed, its memory was only kept for the producer
+        _sc_arena_reset(&conn->arena);
+    }
+    if (rc != SC_FINISHED) {
+        // the response can't be completed anymore, the client sees it cut short
+        sc_error_log(mgr, SC_LL_NORMAL, "[Sculpt] Response producer failed, error code: %d\n", rc);
+        conn->streaming = false;
+        conn->closing = true;
     }
+}
 
-    char method_buf[METHOD_BUF_SIZE];
-    memcpy(method_buf, header, method_len);
-    method_buf[method_len] = '\0';
+// lets the body handler know that the body it was receiving won't be completed
+static void abort_body(sc_conn *conn) {
+    if (conn->parser.state != SC_PARSE_BODY) return;
 
-    // skip extra spaces
-    const char *uri_start = space + 1;
-    while (*uri_start == ' ') uri_start++;
+    conn->parser.state = SC_PARSE_DONE;
+    deliver_body(conn, sc_str_ref_n(NULL, 0));
+}
 
-    // find uri in header
-    const char *uri_end = strchr(uri_start, ' ');
-    if (!uri_end) {
-        return SC_MALFORMED_HEADER_ERR;
+// the response to a request that can't be served. Errors of the request itself are the client's, anything else
+// happened on the server side
+static sc_str error_response(sc_conn_mgr *mgr, int err) {
+    switch (err) {
+        case SC_MALFORMED_HEADER_ERR:
+        case SC_MALFORMED_BODY_ERR:
+        case SC_BUFFER_OVERFLOW_ERR:    // a chunk size or trailer line that doesn't fit in the read buffer
+            return mgr->response_400;
+        case SC_HEADER_TOO_LARGE_ERR:
+            return mgr->response_431;
+        case SC_BODY_TOO_LARGE_ERR:
+            return mgr->response_413;
+        case SC_NOT_IMPLEMENTED_ERR:
+            return mgr->response_501;
+        default:
+            return mgr->response_500;
     }
+}
 
-    size_t uri_len = uri_end - uri_start;
-    if (uri_len == 0 || uri_len > URL_BUF_SIZE) {
-        return SC_BUFFER_OVERFLOW_ERR;
+void cleanup_after_error(sc_conn_mgr *mgr, sc_conn *conn, int err) {
+    if (conn) {
+        abort_body(conn);
+        return_error(conn, error_response(mgr, err));
+        _sc_access_end(mgr, conn);
+    }
+}
+
+static void close_connection(sc_conn_mgr *mgr, sc_conn *conn) {
+    if (conn->uring.active) {
+        _sc_uring_close(mgr, conn);
+        return;
+    }
+    epoll_ctl(mgr->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    sc_mgr_conn_release(mgr, conn);
+}
+
+// registers the events the connection waits for: EPOLLOUT while output is queued, and EPOLLIN unless reading
+// is paused because the queue went over the high-water mark or no more requests will be served
+static void update_connection_events(sc_conn_mgr *mgr, sc_conn *conn) {
+    bool want_read = !conn->closing && !conn->read_closed && _sc_conn_pending(conn) <= mgr->write_high_water
+                     && conn->rbuf_len < conn->rbuf_cap;
+    bool want_write = _sc_conn_pending(conn) > 0 || conn->producer != NULL;
+    if (conn->uring.active) {
+        _sc_uring_update(mgr, conn, want_read, want_write);
+        return;
     }
 
-    char uri_buf[URL_BUF_SIZE];
-    memcpy(uri_buf, uri_start, uri_len);
-    uri_buf[uri_len] = '\0';
+    uint32_t events = (want_read ? EPOLLIN | EPOLLRDHUP : 0) | (want_write ? EPOLLOUT : 0);
+    if (events == conn->events) return;
 
-    http_msg->uri = sc_str_copy_n(uri_buf, uri_len);
-    http_msg->method = sc_str_copy_n(method_buf, method_len);
+    struct epoll_event event = {
+        .events = events,
+        .data.ptr = conn
+    };
+    if (epoll_ctl(mgr->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event) == -1) {
+        sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Failed to update connection events");
+        close_connection(mgr, conn);
+        return;
+    }
+    conn->events = events;
+}
 
-    printf("Result: URI: %s, Method: %s\n", http_msg->uri.buf, http_msg->method.buf);
+// fills the connection read buffer with as much as the socket has, in a single call
+static int read_connection(sc_conn_mgr *mgr, sc_conn *conn) {
+    if (conn->rbuf_len >= conn->rbuf_cap) {
+        return SC_BUFFER_OVERFLOW_ERR;
+    }
 
-    return SC_OK;
+    ssize_t bytes_read = read(conn->fd, conn->rbuf + conn->rbuf_len, conn->rbuf_cap - conn->rbuf_len);
+    if (bytes_read > 0) {
+        conn->rbuf_len += bytes_read;
+        return SC_OK;
+    }
+    if (bytes_read == 0) {
+        // EOF, client closed the connection
+        return SC_CONN_CLOSED;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        // nothing new yet, the parser resumes on the next EPOLLIN
+        return SC_HEADER_PARSE_INCOMPLETE_ERR;
+    }
+    sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Error reading request from client");
+    return SC_READ_ERR;
 }
 
-static int parse_all_headers(sc_conn_mgr *mgr, sc_conn *conn, sc_headers **headers, sc_http_msg *http_msg, bool *keep_alive) {
+static void handle_request(sc_conn_mgr *mgr, sc_conn *conn) {
+    sc_http_msg http_msg = conn->parser.msg;
+    sc_headers *headers = _sc_request_headers(conn);
+
+    // log request
+    sc_log(mgr, SC_LL_DEBUG, "[Sculpt] Request: %s on %s\n", http_msg.method.buf, http_msg.uri.buf);
+    struct _endpoint_list *current = _sc_route_find(mgr->routes, http_msg.uri);
+    conn->parser.route = current;
+
+    if (current && current->body) {
+        // the handler is called with the body as it arrives
+        if (conn->parser.expect_continue && conn->parser.state == SC_PARSE_BODY) {
+            static const char continue_100[] = "HTTP/1.1 100 Continue\r\n\r\n";
+            _sc_conn_write(conn, continue_100, sizeof(continue_100) - 1);
+        }
+        return;
+    }
 
-    int err;
-    // get and parse headers
-    // first, get the initial HTTP header (METHOD URI HTTP/VERSION)
-    char header_buf[HEADER_BUF_SIZE] = {0};
-    err = next_header(conn->fd, header_buf, HEADER_BUF_SIZE);
-    if (err != SC_OK && err != SC_FINISHED) {
-        fprintf(stderr, "[Sculpt] Critical: Error parsing request line header. Proceeding is impossible. Error code: %d\n", err);
-        cleanup_after_error(mgr, conn);
-        return SC_HEADER_PARSE_ERR;
+    // everything else is answered right away. A client waiting for a 100 Continue won't send the body it announced,
+    // so the connection can't be used for another request
+    if (conn->parser.expect_continue && conn->parser.state == SC_PARSE_BODY) {
+        conn->closing = true;
     }
 
-    err = get_http_msg(header_buf, http_msg);
-    if (err != SC_OK) {
-        fprintf(stderr, "[Sculpt] Critical: error parsing URI and Method from HTTP request line. Proceeding is impossible. Error code: %d\n", err); 
-        cleanup_after_error(mgr, conn);
-        return SC_HEADER_PARSE_ERR;
+    if (current && current->response.buf) {
+        // pre-serialized at bind time, nothing to build
+        sc_str response = _sc_conn_keep_alive(conn) ? current->response : current->response_close;
+        struct iovec iov = {response.buf, response.len};
+        if (_sc_conn_writev(conn, &iov, 1) != SC_OK) {
+            sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Error queueing response");
+        }
+        _sc_access_status(conn, response);
+        return;
+    } else if (current && current->metrics) {
+        current_conn = conn;
+        _sc_metrics_serve(mgr, conn->fd);
+        current_conn = NULL;
+        return;
+    } else if (current && current->dir) {
+        // static directories answer 404 themselves when there is no such file
+        if (_sc_static_serve(mgr, conn, current) == SC_OK) {
+            return;
+        }
+    } else if (current) {
+        current_conn = conn;
+        current->func(conn->fd, http_msg, headers);
+        current_conn = NULL;
+        stream_finish(mgr, conn);
+        return;
     }
-    printf("HTTP MSG: %s, %s\n", http_msg->uri.buf, http_msg->method.buf);
 
-    // now, we parse the missing HTTP headers into sc_headers
-    *headers = NULL;
-    int error_count = 0;
-    while (err != SC_FINISHED) {
-        // check if there are happening errors consistently
-        if (error_count >= SC_MAX_HEADER_ERROR_COUNT) {
-            fprintf(stderr, "[Sculpt] More than %d consecutive errors occoured in header parsing. Interrupting parsing process.\n", SC_MAX_HEADER_ERROR_COUNT);
-            return SC_HEADER_PARSE_ERR;
+    // no valid enpoints were found, so we return 404
+    sc_str response = _sc_conn_keep_alive(conn) ? mgr->response_404 : mgr->response_404_close;
+    if (_sc_conn_write(conn, response.buf, response.len) != SC_OK) {
+        sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Error queueing response");
+    }
+    _sc_access_status(conn, response);
+}
+
+// hands the received part of the request body to its handler. Returns SC_FINISHED once the whole body was read
+static int serve_body(sc_conn_mgr *mgr, sc_conn *conn) {
+    sc_str chunk;
+    int rc;
+
+    while ((rc = _sc_body_next(conn, &chunk)) == SC_OK) {
+        deliver_body(conn, chunk);
+        if (_sc_conn_pending(conn) > mgr->write_high_water) {
+            return SC_PENDING;
         }
+    }
 
-        // get next header
-        err = next_header(conn->fd, header_buf, HEADER_BUF_SIZE);
-        if (err != SC_OK && err != SC_FINISHED) {
-            fprintf(stderr, "[Sculpt] Error parsing one of the headers in request, error code: %d\n", err);
-            error_count ++;
-            continue;
+    if (rc == SC_FINISHED) {
+        deliver_body(conn, sc_str_ref_n("", 0));
+        stream_finish(mgr, conn);
+    }
+    return rc;
+}
+
+// requests are only timed for the access log and the metrics
+static inline bool requests_timed(sc_conn_mgr *mgr) {
+    return mgr->access_log != NULL || mgr->metrics != NULL;
+}
+
+// serves every complete request held in the connection buffer, in order, and writes all of their responses at once.
+// returns SC_PENDING if it stopped because the queued output went over the high-water mark
+static int serve_requests(sc_conn_mgr *mgr, sc_conn *conn) {
+    // a producer only adds to the response once the socket took everything queued before
+    if (conn->producer != NULL) {
+        if (_sc_conn_pending(conn) > 0) {
+            return SC_PENDING;
         }
-        if (err == SC_FINISHED) {
-            continue;
+        stream_produce(mgr, conn);
+    }
+
+    while (!conn->closing) {
+        // the next responses wait until the file or stream being sent is done, as they are queued behind it
+        if (_sc_conn_pending(conn) > mgr->write_high_water || conn->file != NULL || conn->producer != NULL) {
+            return SC_PENDING;
         }
 
-        if (strstr(header_buf, "Connection: keep-alive")) {
-            *keep_alive = true;
+        // a request whose body is still arriving continues where it stopped
+        if (conn->parser.state != SC_PARSE_BODY) {
+            if (requests_timed(mgr)) {
+                _sc_access_begin(mgr, conn);
+            }
+            int err = _sc_request_parse(conn, mgr->max_body_size);
+            if (err == SC_HEADER_PARSE_INCOMPLETE_ERR) {
+                // only part of the next request arrived, wait for the rest
+                break;
+            }
+            if (err != SC_OK) {
+                sc_error_log(mgr, SC_LL_NORMAL, "[Sculpt] Error parsing request, error code: %d\n", err);
+                return err;
+            }
+            if (requests_timed(mgr)) {
+                _sc_access_parsed(mgr, conn);
+            }
+            handle_request(mgr, conn);
+            if (conn->closing) break;
         }
 
-        // add header to headers list
-        *headers = sc_header_append(header_buf, *headers);
-        if (headers == NULL) {
-            fprintf(stderr, "[Sculpt] Error appending new header to header list. Headers may be incomplete as a result.");
+        int err = serve_body(mgr, conn);
+        if (err == SC_PENDING) {
+            return SC_PENDING;
+        }
+        if (err == SC_HEADER_PARSE_INCOMPLETE_ERR) {
+            break;
+        }
+        if (err != SC_FINISHED) {
+            sc_error_log(mgr, SC_LL_NORMAL, "[Sculpt] Error reading request body, error code: %d\n", err);
+            return err;
         }
 
-        error_count = 0;
+        bool keep_alive = conn->parser.keep_alive;
+        if (requests_timed(mgr)) {
+            _sc_access_end(mgr, conn);
+        }
+        _sc_request_consume(conn);
+        // the request memory stays until a producer still sending its response is done
+        if (conn->producer == NULL) {
+            _sc_arena_reset(&conn->arena);
+        }
+        if (!keep_alive) {
+            sc_log(mgr, SC_LL_DEBUG, "[Sculpt] Connection close requested\n");
+            conn->closing = true;
+        }
     }
 
     return SC_OK;
 }
 
+void _sc_conn_serve(sc_conn_mgr *mgr, sc_conn *conn) {
+    // requests left in the buffer while the output queue was over the high-water mark are served as soon as
+    // the socket takes enough of it. A producer keeping up with the socket is only called a few times, then the
+    // other connections get their turn and it continues once the socket takes more
+    for (int rounds = 0; ; rounds++) {
+        int rc = serve_requests(mgr, conn);
+        if (rc != SC_OK && rc != SC_PENDING) {
+            cleanup_after_error(mgr, conn, rc);
+        }
+
+        int flushed = SC_OK;
+        if (_sc_conn_pending(conn) > 0) {
+            flushed = _sc_conn_flush(mgr, conn);
+        }
+        if (flushed == SC_SEND_ERR) {
+            close_connection(mgr, conn);
+            return;
+        }
+        if (rc != SC_PENDING || flushed == SC_PENDING) break;
+        if (conn->producer != NULL && rounds >= SC_STREAM_PRODUCE_ROUNDS) break;
+    }
+
+    // the send time of the logged requests ends once the socket took all of their responses
+    if (conn->access.pending_count > 0 && _sc_conn_pending(conn) == 0 && conn->producer == NULL) {
+        _sc_access_sent(mgr, conn, true);
+    }
+
+    if (conn->read_closed && _sc_conn_pending(conn) <= mgr->write_high_water && conn->producer == NULL) {
+        // every complete request was served and nothing more can arrive
+        conn->closing = true;
+    }
+
+    if (conn->closing && _sc_conn_pending(conn) == 0 && conn->producer == NULL) {
+        close_connection(mgr, conn);
+        return;
+    }
+    update_connection_events(mgr, conn);
+}
+
+static void handle_connection_event(sc_conn_mgr *mgr, sc_conn *conn, uint32_t events) {
+    if (events & (EPOLLERR | EPOLLHUP)) {
+        close_connection(mgr, conn);
+        return;
+    }
+    conn->last_active = mgr->now;
+
+    // after the client shut down its side (EPOLLRDHUP), what it sent before is still read, up to the EOF.
+    // it may still read the responses
+    if ((events & (EPOLLIN | EPOLLRDHUP)) && !conn->closing && !conn->read_closed) {
+        int err = read_connection(mgr, conn);
+        if (err == SC_READ_ERR) {
+            close_connection(mgr, conn);
+            return;
+        }
+        if (err == SC_CONN_CLOSED) {
+            conn->read_closed = true;
+        }
+    }
+
+    _sc_conn_serve(mgr, conn);
+}
+
+// a deferring loop stops watching its listening socket, so the clients wait in the kernel accept queue
+static void listener_pause(sc_conn_mgr *mgr, bool pause) {
+    struct epoll_event event = mgr->epoll_event;
+    if (pause) {
+        event.events = 0;
+        mgr->accept_pending = false;
+    }
+    if (epoll_ctl(mgr->epoll_fd, EPOLL_CTL_MOD, mgr->fd, &event) == -1) {
+        sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Failed to change listener events");
+    }
+}
+
 int sc_mgr_poll(sc_conn_mgr *mgr, int timeout_ms) {
     RETURN_ERROR_IF(!mgr, SC_BAD_ARGUMENTS_ERR, "[Sculpt] The mgr pointer cant be null");
-    sc_mgr_conns_cleanup(mgr);
+    if (mgr->uring != NULL) {
+        return _sc_uring_poll(mgr, timeout_ms);
+    }
+
+    // clients left in the queue by the accept budget are picked up right after this batch
+    if (mgr->accept_pending) {
+        timeout_ms = 0;
+    }
+    timeout_ms = _sc_overload_timeout(mgr, timeout_ms);
+    bool accepted = false;
+    int prev_fd = _sc_handoff_prev_fd(mgr);
 
     int n = epoll_wait(mgr->epoll_fd, mgr->events, mgr->max_events, timeout_ms);
     if (n == -1) {
         if (errno == EINTR) { // not an error - the system just got interrupted mid syscall
-            printf("[Sculpt] Warning - epoll_wait interrupted (errno = EINTR)");
+            sc_log(mgr, SC_LL_DEBUG, "[Sculpt] Warning - epoll_wait interrupted (errno = EINTR)\n");
             return SC_OK;
         }
-        perror("[Sculpt] Error no epoll_wait");
+        sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error no epoll_wait");
         return SC_EPOLL_WAIT_ERR;
     }
-    printf("[Sculpt] Connection quantity: %d\n", mgr->conn_count);
+    mgr->now = _sc_clock_now();
+    uint64_t start_ns = _sc_overload_begin(mgr);
+    sc_log(mgr, SC_LL_DEBUG, "[Sculpt] Connection quantity: %d\n", mgr->conn_count);
+    if (n > 0) {
+        _SC_STAT_ADD(mgr->stats.polls, 1);
+        _SC_STAT_ADD(mgr->stats.events, n);
+        __atomic_store_n(&mgr->stats.last_batch, n, __ATOMIC_RELAXED);
+    }
 
     for (int i = 0; i < n; i++) {
-       // handle errors with the epoll event
-        if (mgr->events[i].events & EPOLLERR) {
-            sc_conn *conn = mgr->events[i].data.ptr;
-            perror("[Sculpt] Error with epoll, closing connection...");
-            cleanup_after_error(mgr, conn);
-            continue;
-        }
-
         if (mgr->events[i].data.fd == mgr->fd) {
-            int rc = create_new_connection(mgr);
-            if (rc == SC_CONTINUE) continue;
+            if (mgr->events[i].events & EPOLLERR) {
+                sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error with epoll on the listening socket");
+                continue;
+            }
+            accepted = true;
+            int rc = accept_connections(mgr);
             if (rc != SC_OK) return rc;
+        } else if (mgr->events[i].data.fd == prev_fd) {
+            _sc_handoff_receive(mgr);
         } else {
             // existing connection handling
             sc_conn *conn = mgr->events[i].data.ptr;
             if (!conn) {
-                perror("[Sculpt] Critical: Error gathering connection struct from epoll event");
-                continue;
-            }
-            if (mgr->events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
-                epoll_ctl(mgr->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
-                close(conn->fd);
-                sc_mgr_conn_release(mgr, conn);
+                sc_error_log(mgr, SC_LL_MINIMAL, "[Sculpt] Critical: Error gathering connection struct from epoll event\n");
                 continue;
             }
 
-            if (mgr->events[i].events & EPOLLIN) {
-                bool keep_alive = false;
-                conn->last_active = time(NULL);
-                
-                sc_headers *headers = NULL;
-                sc_http_msg http_msg;
-                int err = parse_all_headers(mgr, conn, &headers, &http_msg, &keep_alive);
-                if (err != SC_OK) {
-                    sc_headers_free(headers);
-                }
+            // all other responsibilities are passed to the handler, so no need to do anything else
+            handle_connection_event(mgr, conn, mgr->events[i].events);
+        }
+    }
 
-                // log request
-                printf("[Sculpt] Request: %s on %s\n", http_msg.method.buf, http_msg.uri.buf);
-                struct _endpoint_list *current = mgr->endpoints;
-                while (current) {
-                    if (current->soft) {
-                        // we call it even if just the prefix matches
-                        if (sc_strprefix(http_msg.uri, current->val)) {
-                            // the uri buffer starts with the prefix of the endpoint
-                            current->func(conn->fd, http_msg, headers);
-                            sc_str_free(&http_msg.uri);
-                            sc_str_free(&http_msg.method);
-                            goto end;
-                        }
-                    } else {
-                        if(sc_strcmp(current->val, http_msg.uri) == 0) {
-                            // the uri buffer is EQUAL to the endpoint
-                            current->func(conn->fd, http_msg, headers);
-                            sc_str_free(&http_msg.uri);
-                            sc_str_free(&http_msg.method);
-                            goto end;
-                        }
-                    }
-                    current = current->next;
-                }
+    // expiry runs after the batch, so no event in it can point to a connection closed here
+    sc_mgr_conns_cleanup(mgr);
 
-                // no valid enpoints were found, so we return 404
-                const char *http_response_404 = 
-                "HTTP/1.1 404 NOT FOUND\r\n"
-                "Content-Type: text/html; charset=UTF-8\r\n"
-                "Content-Length: 9\r\n"
-                "Connection: keep-alive\r\n"
-                "\r\n"
-                "NOT FOUND";
-                if (send(conn->fd, http_response_404, strlen(http_response_404), 0) == -1) {
-                    perror("[Sculpt] Error sending response");
-                }
+    if (_sc_overload_update(mgr, start_ns, n, (size_t) n == mgr->max_events) && mgr->shed_mode == SC_SHED_DEFER
+        && mgr->listening) {
+        listener_pause(mgr, mgr->shedding);
+    }
+
+    if (mgr->accept_pending && !accepted) {
+        return accept_connections(mgr);
+    }
+
+    return SC_OK;
+}
+
+void _sc_conn_unlisten(sc_conn_mgr *mgr) {
+    if (mgr->fd < 0) return;
+
+    if (mgr->uring != NULL) {
+        _sc_uring_unlisten(mgr);
+    } else {
+        // the socket stays open in the new process, so epoll would keep reporting it after the close
+        epoll_ctl(mgr->epoll_fd, EPOLL_CTL_DEL, mgr->fd, NULL);
+    }
+    close(mgr->fd);
+    mgr->fd = -1;
+    mgr->listening = false;
+    mgr->accept_pending = false;
+}
+
+// between two requests: nothing received, queued or produced, so the connection can move without losing a byte
+static bool conn_idle(sc_conn *conn) {
+    return conn->state == CONN_ACTIVE && !conn->closing && !conn->read_closed && !conn->uring.closed
+           && conn->rbuf_len == 0 && conn->parser.state == SC_PARSE_REQUEST_LINE && _sc_conn_pending(conn) == 0
+           && conn->file == NULL && conn->producer == NULL && !conn->streaming && (!conn->uring.active || conn->uring.held_head == -1);
+}
+
+static void hand_off_connection(sc_conn_mgr *mgr, sc_conn *conn) {
+    if (conn->uring.active) {
+        _sc_uring_hand_off(mgr, conn);
+        return;
+    }
+
+    int rc = _sc_handoff_send(mgr, conn->fd);
+    if (rc == SC_PENDING) return;
+    if (rc != SC_OK) {
+        close_connection(mgr, conn);
+        return;
+    }
+    // the new process has the socket now, it must leave this epoll before the close
+    epoll_ctl(mgr->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    sc_mgr_conn_release(mgr, conn);
+}
+
+void _sc_conn_drain(sc_conn_mgr *mgr) {
+    for (int i = 0; i < mgr->slab_count && mgr->conn_count > 0; i++) {
+        struct _sc_conn_slab *slab = mgr->slabs[i];
+        if (slab == NULL || slab->used == 0) continue;
 
-                end:
-                    sc_headers_free(headers);
-                    if (!keep_alive) {
-                        printf("[Sculpt] Connection close requested\n");
-                        close(conn->fd);
-                        sc_mgr_conn_release(mgr, conn);
-                        epoll_ctl(mgr->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
-                    } else {
-                        // re-add the connection to epoll for further requests
-                        struct epoll_event event = {
-                            .events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT,
-                            .data.ptr = conn
-                        };
-                        if (epoll_ctl(mgr->epoll_fd, EPOLL_CTL_MOD, conn->fd, &event) == -1) {
-                            perror("[Sculpt] Failed to re-add connection to epoll");
-                            close(conn->fd);
-                            sc_mgr_conn_release(mgr, conn);
-                            epoll_ctl(mgr->epoll_fd, EPOLL_CTL_DEL, conn->fd, &event);
-                        }
-                    }
-
-                // all other responsibilities are passed to the handler, so no need to do anything else
-            } else {
-                perror("[Sculpt] Error reading from client");
+        for (int j = 0; j < SC_CONN_SLAB_SIZE; j++) {
+            if (conn_idle(&slab->conns[j])) {
+                hand_off_connection(mgr, &slab->conns[j]);
             }
         }
     }
+}
 
-    return SC_OK;
+// first second at which the connection is idle for too long or too old
+static time_t conn_deadline(sc_conn_mgr *mgr, sc_conn *conn) {
+    time_t idle = conn->last_active + mgr->conn_timeout;
+    time_t age = conn->creation_time + mgr->conn_max_age;
+    return (idle < age ? idle : age) + 1;
+}
+
+// slabs with free connections: the partly used ones at the head, new clients are taken from there
+static void slab_open_push(sc_conn_mgr *mgr, struct _sc_conn_slab *slab) {
+    slab->prev = NULL;
+    slab->next = mgr->open_slabs;
+    if (mgr->open_slabs != NULL) {
+        mgr->open_slabs->prev = slab;
+    } else {
+        mgr->open_slabs_tail = slab;
+    }
+    mgr->open_slabs = slab;
+}
+
+// and the empty ones at the tail, so they drain and can be given back
+static void slab_open_append(sc_conn_mgr *mgr, struct _sc_conn_slab *slab) {
+    slab->next = NULL;
+    slab->prev = mgr->open_slabs_tail;
+    if (mgr->open_slabs_tail != NULL) {
+        mgr->open_slabs_tail->next = slab;
+    } else {
+        mgr->open_slabs = slab;
+    }
+    mgr->open_slabs_tail = slab;
+}
+
+static void slab_open_unlink(sc_conn_mgr *mgr, struct _sc_conn_slab *slab) {
+    if (slab->prev != NULL) {
+        slab->prev->next = slab->next;
+    } else {
+        mgr->open_slabs = slab->next;
+    }
+    if (slab->next != NULL) {
+        slab->next->prev = slab->prev;
+    } else {
+        mgr->open_slabs_tail = slab->prev;
+    }
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+static struct _sc_conn_slab *slab_create(sc_conn_mgr *mgr) {
+    int index = 0;
+    while (index < mgr->slab_count && mgr->slabs[index] != NULL) {
+        index++;
+    }
+    if (index == mgr->slab_count) return NULL;
+
+    // cache line aligned, so the first line of every connection holds only its hot fields
+    struct _sc_conn_slab *slab = aligned_alloc(_Alignof(struct _sc_conn_slab), sizeof(struct _sc_conn_slab));
+    if (slab == NULL) return NULL;
+    memset(slab, 0, sizeof(*slab));
+    slab->index = index;
+    for (int i = SC_CONN_SLAB_SIZE - 1; i >= 0; i--) {
+        slab->conns[i].state = CONN_IDLE;
+        slab->conns[i].slab = slab;
+        slab->conns[i].next = slab->free;
+        slab->free = &slab->conns[i];
+    }
+
+    mgr->slabs[index] = slab;
+    mgr->slabs_allocated++;
+    _SC_STAT_ADD(mgr->stats.allocated, SC_CONN_SLAB_SIZE);
+    slab_open_push(mgr, slab);
+    return slab;
+}
+
+// frees what a connection kept while in the pool
+static void conn_free(sc_conn *conn) {
+    free(conn->rbuf);
+    free(conn->wbuf);
+    free(conn->uring.sbuf);
+    _sc_arena_free(&conn->arena);
+}
+
+static void slab_destroy(sc_conn_mgr *mgr, struct _sc_conn_slab *slab) {
+    // a full slab is not in the open list
+    if (slab->free != NULL) {
+        slab_open_unlink(mgr, slab);
+    }
+    for (int i = 0; i < SC_CONN_SLAB_SIZE; i++) {
+        conn_free(&slab->conns[i]);
+    }
+
+    mgr->slabs[slab->index] = NULL;
+    mgr->slabs_allocated--;
+    _SC_STAT_ADD(mgr->stats.allocated, -SC_CONN_SLAB_SIZE);
+    free(slab);
+}
+
+// gives back the slabs that stayed empty for SC_CONN_SLAB_IDLE seconds, keeping one for the next clients. The empty
+// slabs are all at the tail of the open list, so only they are looked at, once a second
+static void pool_shrink(sc_conn_mgr *mgr) {
+    if (mgr->pool_checked == mgr->now) return;
+    mgr->pool_checked = mgr->now;
+
+    struct _sc_conn_slab *slab = mgr->open_slabs_tail;
+    while (slab != NULL && slab->used == 0 && mgr->slabs_allocated > 1) {
+        struct _sc_conn_slab *prev = slab->prev;
+        if (mgr->now - slab->empty_since >= SC_CONN_SLAB_IDLE) {
+            slab_destroy(mgr, slab);
+        }
+        slab = prev;
+    }
 }
 
 int sc_mgr_conn_pool_init(sc_conn_mgr *mgr, int max_conns) {
     RETURN_ERROR_IF(!mgr, SC_BAD_ARGUMENTS_ERR, "[Sculpt] NULL manager provided");
+    RETURN_ERROR_IF(max_conns < 1, SC_BAD_ARGUMENTS_ERR, "[Sculpt] The pool needs room for a connection");
 
     mgr->max_conn_count = max_conns;
     mgr->conn_count = 0;
 
-    mgr->conn_pool = calloc(max_conns, sizeof(sc_conn));
-    if (mgr->conn_pool == NULL) {
+    mgr->slab_count = (max_conns + SC_CONN_SLAB_SIZE - 1) / SC_CONN_SLAB_SIZE;
+    mgr->slabs = calloc(mgr->slab_count, sizeof(struct _sc_conn_slab *));
+    if (mgr->slabs == NULL) {
         return SC_MALLOC_ERR;
     }
 
-    mgr->free_conns = &mgr->conn_pool[0]; // free conns will be the same as con poolat the start
-    // link list until max_conns - 1 to avoid segfault
-    for(int i = 0; i < max_conns - 1; i++) {
-        mgr->conn_pool[i].next = &mgr->conn_pool[i + 1];
-        mgr->conn_pool[i].state = CONN_IDLE;
+    // the first slab up front, the others as clients arrive
+    if (slab_create(mgr) == NULL) {
+        sc_mgr_conn_pool_destroy(mgr);
+        return SC_MALLOC_ERR;
     }
-    mgr->conn_pool[max_conns - 1].next = NULL;
-    mgr->conn_pool[max_conns - 1].state = CONN_IDLE;
 
     mgr->conn_timeout = SC_DEFAULT_CONN_TIMEOUT;
     mgr->conn_max_age = SC_DEFAULT_CONN_MAX_AGE;
@@ -433,17 +955,52 @@ int sc_mgr_conn_pool_init(sc_conn_mgr *mgr, int max_conns) {
 sc_conn *sc_mgr_conn_get_free(sc_conn_mgr *mgr) {
     if (mgr == NULL || mgr->conn_count >= mgr->max_conn_count) return NULL;
 
-    // pop first free conn from list
-    sc_conn *conn = mgr->free_conns;
-    mgr->free_conns = mgr->free_conns->next;
+    struct _sc_conn_slab *slab = mgr->open_slabs;
+    if (slab == NULL && (slab = slab_create(mgr)) == NULL) {
+        return NULL;
+    }
+    sc_conn *conn = slab->free;
+
+    // the read buffer is allocated on first use and kept while the conn is in the pool, like the arena first block
+    if (conn->rbuf == NULL) {
+        conn->rbuf = malloc(SC_CONN_READ_BUF_SIZE);
+        if (conn->rbuf == NULL) {
+            return NULL;
+        }
+        conn->rbuf_cap = SC_CONN_READ_BUF_SIZE;
+    }
+
+    // pop first free conn from its slab, which leaves the open list once it is full
+    slab->free = conn->next;
+    slab->used++;
+    if (slab->free == NULL) {
+        slab_open_unlink(mgr, slab);
+    }
 
     // clear previous conn state
     // init new conn
-    time_t current_time = time(NULL);
-    conn->last_active = current_time;
-    conn->creation_time = current_time;
+    conn->last_active = mgr->now;
+    conn->creation_time = mgr->now;
     conn->state = CONN_ACTIVE;
     conn->fd = -1; // fd will be invalid until it is set
+    conn->rbuf_len = 0;
+    conn->wbuf_len = 0;
+    conn->wbuf_off = 0;
+    conn->events = 0;
+    conn->read_closed = false;
+    conn->closing = false;
+    conn->file = NULL;
+    conn->streaming = false;
+    conn->stream_raw = false;
+    conn->producer = NULL;
+    conn->producer_ctx = NULL;
+    conn->out_bytes = 0;
+    conn->access.start = 0;
+    conn->access.pending_count = 0;
+    _sc_parser_reset(conn);
+
+    conn->timer.data = conn;
+    _sc_timer_add(&mgr->timers, &conn->timer, conn_deadline(mgr, conn));
 
     __atomic_fetch_add(&mgr->conn_count, 1, __ATOMIC_SEQ_CST);
 
@@ -453,49 +1010,100 @@ sc_conn *sc_mgr_conn_get_free(sc_conn_mgr *mgr) {
 void sc_mgr_conn_release(sc_conn_mgr *mgr, sc_conn *conn) {
     if (!conn) return;
 
+    // a body handler still waiting for the rest of the body is told first, anything it sends is dropped below
+    abort_body(conn);
+    if (conn->producer != NULL) {
+        conn->producer(-1, conn->producer_ctx);
+        conn->producer = NULL;
+        conn->producer_ctx = NULL;
+    }
+    conn->streaming = false;
+    conn->stream_raw = false;
+    _sc_access_sent(mgr, conn, false);
+
     // reset the connection
     conn->state = CONN_CLOSING;
-    conn->last_active = time(NULL);
+    conn->last_active = mgr->now;
+    _sc_timer_del(&conn->timer);
+    conn->rbuf_len = 0;
+    conn->wbuf_len = 0;
+    conn->wbuf_off = 0;
+    _sc_file_put(conn->file);
+    conn->file = NULL;
+    _sc_parser_reset(conn);
+    _sc_arena_reset(&conn->arena);
+
+    // add connection back to the free stack of its slab
+    struct _sc_conn_slab *slab = conn->slab;
+    bool was_full = slab->free == NULL;
+    conn->next = slab->free;
+    slab->free = conn;
+    slab->used--;
+    if (slab->used == 0) {
+        slab->empty_since = mgr->now;
+        if (!was_full) {
+            slab_open_unlink(mgr, slab);
+        }
+        slab_open_append(mgr, slab);
+    } else if (was_full) {
+        slab_open_push(mgr, slab);
+    }
+
 
-    // add connection back to free connection stack
-    conn->next = mgr->free_conns;
-    mgr->free_conns = conn;
-    
     __atomic_fetch_sub(&mgr->conn_count, 1, __ATOMIC_SEQ_CST); // decrement the mgr conn count
 }
 
+static void expire_connection(struct _sc_timer *timer, void *ctx) {
+    sc_conn_mgr *mgr = ctx;
+    sc_conn *conn = timer->data;
+
+    // activity only updates last_active, so the timer is moved to the real deadline when it fires too early
+    time_t deadline = conn_deadline(mgr, conn);
+    if (deadline > mgr->now) {
+        _sc_timer_add(&mgr->timers, &conn->timer, deadline);
+        return;
+    }
+
+    // close the fd
+    _SC_STAT_ADD(mgr->stats.timeouts, 1);
+    shutdown(conn->fd, SHUT_RDWR);
+    close_connection(mgr, conn);
+}
+
 void sc_mgr_conns_cleanup(sc_conn_mgr *mgr) {
-    time_t now = time(NULL);
+    _sc_timer_wheel_advance(&mgr->timers, mgr->now, expire_connection, mgr);
+    pool_shrink(mgr);
 
-    for (size_t i = 0; i < mgr->max_conn_count; i++) {
-        sc_conn *conn = &mgr->conn_pool[i];
-        
-        // check time limits
-        if ((CONN_ACTIVE == conn->state) &&
-        (now - conn->last_active > mgr->conn_timeout || now - conn->creation_time > mgr->conn_max_age)) {
-            
-            // close the fd
-            shutdown(conn->fd, SHUT_RDWR);
-            close(conn->fd);
-            epoll_ctl(mgr->epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
-            sc_mgr_conn_release(mgr, conn);
-        }
+    sc_conn_mgr *main_loop = mgr->parent != NULL ? mgr->parent : mgr;
+    if (main_loop->handoff != NULL) {
+        _sc_handoff_check(mgr);
     }
 }
 
 void sc_mgr_conn_pool_destroy(sc_conn_mgr *mgr) {
-    // close all active connections from array
-    for (int i = 0; i < mgr->max_conn_count; i++) {
-        sc_conn *conn = &mgr->conn_pool[i];
-        if (conn->state == CONN_ACTIVE) {
-            close(conn->fd);
+    if (mgr->slabs == NULL) return;
+
+    // close all active connections of every slab
+    for (int i = 0; i < mgr->slab_count; i++) {
+        struct _sc_conn_slab *slab = mgr->slabs[i];
+        if (slab == NULL) continue;
+
+        for (int j = 0; j < SC_CONN_SLAB_SIZE; j++) {
+            sc_conn *conn = &slab->conns[j];
+            if (conn->state == CONN_ACTIVE) {
+                close(conn->fd);
+                _sc_file_put(conn->file);
+                if (conn->producer != NULL) {
+                    conn->producer(-1, conn->producer_ctx);
+                }
+            }
         }
-        //free(conn);
+        slab_destroy(mgr, slab);
     }
-    
+
     // free pools
-    free(mgr->conn_pool);
-    mgr->conn_pool = NULL;
-    mgr->free_conns = NULL;
+    free(mgr->slabs);
+    mgr->slabs = NULL;
+    mgr->slab_count = 0;
 
 }
@@ -0,0 +1,383 @@
+#include "sculpt.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+#define HANDOFF_MAGIC 0x4f484353    // "SCHO"
+#define HANDOFF_LISTENERS 1
+#define HANDOFF_CONN 2
+#define HANDOFF_MAX_FDS 253         // SCM_MAX_FD, the most a message can carry
+
+/* The processes talk over a SOCK_SEQPACKET Unix socket, so every message arrives whole with its fds: first the
+ * listening sockets of all the loops of the old process, the main loop one first, then one message per idle
+ * connection it hands over while draining. It closes the socket when it exits. */
+struct _sc_handoff_msg {
+    uint32_t magic;
+    uint32_t type;
+    uint32_t count;                 // fds attached
+};
+
+struct _sc_handoff {
+    // handing over to the next process
+    char path[sizeof(((struct sockaddr_un *) NULL)->sun_path)];
+    int listen_fd;                  // where it connects, -1 if not enabled or once it did
+    bool conns;                     // idle connections are handed over too
+    int next_fd;                    // the new process, the loops send it their connections
+    bool handed_off;                // set by the main loop once the listening sockets were sent
+    time_t checked;                 // when listen_fd was last looked at
+
+    // taking over from the previous one
+    int prev_fd;                    // the old process while it drains, -1 once it is done
+    int fds[HANDOFF_MAX_FDS];       // its listening sockets, the first taken by the main loop
+    int fd_count;
+    int fds_used;
+};
+
+static struct _sc_handoff *handoff_get(sc_conn_mgr *mgr) {
+    if (mgr->handoff == NULL) {
+        struct _sc_handoff *h = calloc(1, sizeof(*h));
+        if (h == NULL) return NULL;
+        h->listen_fd = -1;
+        h->next_fd = -1;
+        h->prev_fd = -1;
+        mgr->handoff = h;
+    }
+    return mgr->handoff;
+}
+
+static int handoff_addr(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (path == NULL || path[0] == '\0' || strlen(path) >= sizeof(addr->sun_path)) return SC_BAD_ARGUMENTS_ERR;
+    strcpy(addr->sun_path, path);
+    return SC_OK;
+}
+
+static int msg_send(int fd, uint32_t type, const int *fds, int count) {
+    struct _sc_handoff_msg msg = {HANDOFF_MAGIC, type, (uint32_t) count};
+    struct iovec iov = {&msg, sizeof(msg)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr hdr = {.msg_iov = &iov, .msg_iovlen = 1};
+
+    if (count > 0) {
+        hdr.msg_control = control.buf;
+        hdr.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+    }
+    return sendmsg(fd, &hdr, MSG_NOSIGNAL | MSG_DONTWAIT) == sizeof(msg) ? SC_OK : SC_SEND_ERR;
+}
+
+// receives a message and its fds. Returns its size, 0 once the other process closed the socket, or -1 with errno
+static ssize_t msg_recv(int fd, struct _sc_handoff_msg *msg, int *fds, int *count, int flags) {
+    struct iovec iov = {msg, sizeof(*msg)};
+    union {
+        char buf[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+        struct cmsghdr align;
+    } control;
+    struct msghdr hdr = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf,
+                         .msg_controllen = sizeof(control.buf)};
+
+    *count = 0;
+    ssize_t n = recvmsg(fd, &hdr, flags | MSG_CMSG_CLOEXEC);
+    if (n <= 0) return n;
+
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) continue;
+        int received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        memcpy(fds + *count, CMSG_DATA(cmsg), sizeof(int) * received);
+        *count += received;
+    }
+
+    // fds that came with something else than our messages aren't kept
+    if (n != sizeof(*msg) || msg->magic != HANDOFF_MAGIC) {
+        for (int i = 0; i < *count; i++) {
+            close(fds[i]);
+        }
+        *count = 0;
+        errno = EPROTO;
+        return -1;
+    }
+    return n;
+}
+
+int sc_mgr_handoff_enable(sc_conn_mgr *mgr, const char *path, bool conns) {
+    struct sockaddr_un addr;
+    if (mgr == NULL || mgr->parent != NULL || mgr->worker_count > 0 || handoff_addr(path, &addr) != SC_OK) {
+        return SC_BAD_ARGUMENTS_ERR;
+    }
+    struct _sc_handoff *h = handoff_get(mgr);
+    if (h == NULL) return SC_MALLOC_ERR;
+    if (h->listen_fd >= 0 || h->handed_off) return SC_BAD_ARGUMENTS_ERR;
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error: error creating the handoff socket");
+        return SC_SOCKET_CREATION_ERR;
+    }
+
+    // a file left there belongs to a process that handed over already, or that is gone
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error: failed to listen for the next process");
+        close(fd);
+        return SC_SOCKET_BIND_ERR;
+    }
+
+    strcpy(h->path, path);
+    h->listen_fd = fd;
+    h->conns = conns;
+    return SC_OK;
+}
+
+int sc_mgr_takeover(sc_conn_mgr *mgr, const char *path) {
+    struct sockaddr_un addr;
+    if (mgr == NULL || mgr->parent != NULL || mgr->listening || mgr->epoll_fd >= 0 || mgr->uring != NULL
+        || handoff_addr(path, &addr) != SC_OK) {
+        return SC_BAD_ARGUMENTS_ERR;
+    }
+    // enabling the handoff first would replace the socket of the old process with our own
+    if (mgr->handoff != NULL && (mgr->handoff->listen_fd >= 0 || mgr->handoff->fd_count > 0)) {
+        return SC_BAD_ARGUMENTS_ERR;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error: error creating the handoff socket");
+        return SC_SOCKET_CREATION_ERR;
+    }
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        sc_log(mgr, SC_LL_NORMAL, "[Sculpt] No server to take over at %s\n", path);
+        close(fd);
+        return SC_HANDOFF_ERR;
+    }
+
+    // the old process looks for us once a second
+    struct timeval timeout = {SC_HANDOFF_TIMEOUT, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    struct _sc_handoff_msg msg;
+    int fds[HANDOFF_MAX_FDS];
+    int count;
+    ssize_t n = msg_recv(fd, &msg, fds, &count, 0);
+    if (n <= 0 || msg.type != HANDOFF_LISTENERS || count == 0) {
+        if (n < 0) {
+            sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error: the listening sockets weren't handed over");
+        } else {
+            sc_error_log(mgr, SC_LL_MINIMAL, "[Sculpt] Error: the listening sockets weren't handed over\n");
+        }
+        for (int i = 0; i < count; i++) {
+            close(fds[i]);
+        }
+        close(fd);
+        return SC_HANDOFF_ERR;
+    }
+
+    // the old process may have been started for another port
+    struct sockaddr_in bound;
+    socklen_t bound_len = sizeof(bound);
+    if (getsockname(fds[0], (struct sockaddr *) &bound, &bound_len) < 0
+        || bound.sin_port != mgr->addr_info._sock_addr.sin_port) {
+        sc_error_log(mgr, SC_LL_MINIMAL, "[Sculpt] Error: the server at %s listens on another port\n", path);
+        for (int i = 0; i < count; i++) {
+            close(fds[i]);
+        }
+        close(fd);
+        return SC_HANDOFF_ERR;
+    }
+
+    struct _sc_handoff *h = handoff_get(mgr);
+    if (h == NULL) {
+        for (int i = 0; i < count; i++) {
+            close(fds[i]);
+        }
+        close(fd);
+        return SC_MALLOC_ERR;
+    }
+
+    // the socket of sc_mgr_create() was never listening, no client is lost with it
+    close(mgr->fd);
+    mgr->fd = fds[0];
+    memcpy(h->fds, fds, sizeof(int) * count);
+    h->fd_count = count;
+    h->fds_used = 1;
+    h->prev_fd = fd;
+    sc_log(mgr, SC_LL_NORMAL, "[Sculpt] Took over %d listening sockets from %s\n", count, path);
+    return SC_OK;
+}
+
+bool sc_mgr_drained(sc_conn_mgr *mgr) {
+    if (mgr == NULL || !__atomic_load_n(&mgr->drained, __ATOMIC_ACQUIRE)) return false;
+
+    int workers = __atomic_load_n(&mgr->worker_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < workers; i++) {
+        if (!__atomic_load_n(&mgr->workers[i]->drained, __ATOMIC_ACQUIRE)) return false;
+    }
+    return true;
+}
+
+void _sc_handoff_worker(sc_conn_mgr *mgr, sc_conn_mgr *worker) {
+    struct _sc_handoff *h = mgr->handoff;
+    if (h == NULL || h->fds_used >= h->fd_count) return;
+
+    close(worker->fd);
+    worker->fd = h->fds[h->fds_used++];
+}
+
+int _sc_handoff_prev_fd(sc_conn_mgr *mgr) {
+    return mgr->handoff != NULL ? mgr->handoff->prev_fd : -1;
+}
+
+// sends the listening sockets of every loop to a new process that connected
+static void handoff_accept(sc_conn_mgr *mgr) {
+    struct _sc_handoff *h = mgr->handoff;
+    if (h->listen_fd < 0 || h->checked == mgr->now) return;
+    h->checked = mgr->now;
+
+    int fd = accept4(h->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Error accepting on the handoff socket");
+        }
+        return;
+    }
+
+    // whoever gets the listening sockets serves our clients
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len) < 0 || cred.uid != geteuid()) {
+        sc_error_log(mgr, SC_LL_MINIMAL, "[Sculpt] Refused to hand the server over to a process of another user\n");
+        close(fd);
+        return;
+    }
+
+    int fds[HANDOFF_MAX_FDS];
+    int count = 0;
+    fds[count++] = mgr->fd;
+    for (int i = 0; i < mgr->worker_count && count < HANDOFF_MAX_FDS; i++) {
+        fds[count++] = mgr->workers[i]->fd;
+    }
+    if (msg_send(fd, HANDOFF_LISTENERS, fds, count) != SC_OK) {
+        sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Failed to hand the listening sockets over");
+        close(fd);
+        return;
+    }
+
+    close(h->listen_fd);
+    h->listen_fd = -1;
+    h->next_fd = fd;
+    __atomic_store_n(&h->handed_off, true, __ATOMIC_RELEASE);
+    sc_log(mgr, SC_LL_NORMAL, "[Sculpt] Handed %d listening sockets over, draining\n", count);
+}
+
+// closes the listening sockets taken over that no loop took, the clients queued on them are dropped
+static void handoff_leftovers(sc_conn_mgr *mgr) {
+    struct _sc_handoff *h = mgr->handoff;
+    if (h->fds_used >= h->fd_count) return;
+
+    sc_error_log(mgr, SC_LL_NORMAL, "[Sculpt] Warning: the previous server had %d event loops, closing %d of its "
+                 "listening sockets\n", h->fd_count, h->fd_count - h->fds_used);
+    while (h->fds_used < h->fd_count) {
+        close(h->fds[h->fds_used++]);
+    }
+}
+
+void _sc_handoff_check(sc_conn_mgr *mgr) {
+    if (mgr->parent == NULL) {
+        handoff_leftovers(mgr);
+        handoff_accept(mgr);
+    }
+
+    struct _sc_handoff *h = mgr->parent != NULL ? mgr->parent->handoff : mgr->handoff;
+    if (!mgr->draining && __atomic_load_n(&h->handed_off, __ATOMIC_ACQUIRE)) {
+        mgr->draining = true;
+        _sc_conn_unlisten(mgr);
+    }
+    if (!mgr->draining || mgr->drained) return;
+
+    _sc_conn_drain(mgr);
+    if (mgr->conn_count == 0) {
+        __atomic_store_n(&mgr->drained, true, __ATOMIC_RELEASE);
+        sc_log(mgr, SC_LL_NORMAL, "[Sculpt] Event loop drained, %llu connections handed over\n",
+               (unsigned long long) mgr->stats.handed_off);
+    }
+}
+
+int _sc_handoff_send(sc_conn_mgr *mgr, int fd) {
+    struct _sc_handoff *h = mgr->parent != NULL ? mgr->parent->handoff : mgr->handoff;
+    if (!h->conns) return SC_SEND_ERR;
+
+    if (msg_send(h->next_fd, HANDOFF_CONN, &fd, 1) == SC_OK) {
+        _SC_STAT_ADD(mgr->stats.handed_off, 1);
+        return SC_OK;
+    }
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return SC_PENDING;
+    }
+    sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Failed to hand a connection over");
+    return SC_SEND_ERR;
+}
+
+void _sc_handoff_receive(sc_conn_mgr *mgr) {
+    struct _sc_handoff *h = mgr->handoff;
+
+    while (h->prev_fd >= 0) {
+        struct _sc_handoff_msg msg;
+        int fds[HANDOFF_MAX_FDS];
+        int count;
+        ssize_t n = msg_recv(h->prev_fd, &msg, fds, &count, MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+
+        if (n <= 0) {
+            if (n < 0) {
+                sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Error receiving connections from the previous server");
+            } else {
+                sc_log(mgr, SC_LL_NORMAL, "[Sculpt] The previous server exited\n");
+            }
+            if (mgr->epoll_fd >= 0) {
+                epoll_ctl(mgr->epoll_fd, EPOLL_CTL_DEL, h->prev_fd, NULL);
+            }
+            close(h->prev_fd);
+            h->prev_fd = -1;
+            return;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (msg.type == HANDOFF_CONN) {
+                _sc_conn_adopt(mgr, fds[i]);
+            } else {
+                close(fds[i]);
+            }
+        }
+    }
+}
+
+void _sc_handoff_destroy(sc_conn_mgr *mgr) {
+    struct _sc_handoff *h = mgr->handoff;
+    if (h == NULL) return;
+
+    // nobody took over, the file is ours
+    if (h->listen_fd >= 0) {
+        close(h->listen_fd);
+        unlink(h->path);
+    }
+    if (h->next_fd >= 0) {
+        close(h->next_fd);
+    }
+    if (h->prev_fd >= 0) {
+        close(h->prev_fd);
+    }
+    while (h->fds_used < h->fd_count) {
+        close(h->fds[h->fds_used++]);
+    }
+    free(h);
+    mgr->handoff = NULL;
+}
@@ -4,54 +4,57 @@
 
 #include "sculpt.h"
 
-static sc_headers *_create_header(const char *header, sc_headers *next) {
-    sc_headers *headers = malloc(sizeof(sc_headers));
+// the node and its string are allocated in a single block, with the \r\n appended if it is missing.
+// nodes from a request arena are marked as ref, so sc_headers_free() leaves them alone
+static sc_headers *_create_header(struct _sc_arena *arena, const char *header, sc_headers *next) {
+    size_t len = strlen(header);
+    bool add_crlf = len < 2 || header[len - 2] != '\r' || header[len - 1] != '\n';
+    size_t header_len = len + (add_crlf ? 2 : 0);
+
+    size_t size = sizeof(sc_headers) + header_len + 1;
+    sc_headers *headers = arena != NULL ? _sc_arena_alloc(arena, size) : malloc(size);
     if (headers == NULL) {
         return NULL;
     }
-    
-    headers->header = sc_str_copy(header);
-    if (headers->header.buf == NULL) {
-        sc_headers_free(headers);
-        return NULL;
+
+    char *buf = (char *) (headers + 1);
+    memcpy(buf, header, len);
+    if (add_crlf) {
+        memcpy(buf + len, "\r\n", 2);
     }
+    buf[header_len] = '\0';
 
+    headers->header = sc_str_ref_n(buf, header_len);
+    headers->ref = arena != NULL;
     headers->next = next;
 
     return headers;
 }
 
 sc_headers *sc_header_append(const char *header, sc_headers *list) {
-    sc_headers *res;
-    if (!strstr(header, "\r\n")) {
-        size_t len = strlen(header) + 3;
-        char *h = malloc(len);
-        if (h == NULL) {
-            return NULL;
-        }
-        h[len - 1] = '\0';
-        snprintf(h, len, "%s\r\n", header); 
-        res = _create_header(h, list);
-        free(h);
-    } else {
-        res = _create_header(header, list);
+    return _create_header(NULL, header, list);
+}
+
+sc_headers *sc_req_header_append(int fd, const char *header, sc_headers *list) {
+    sc_conn *conn = _sc_conn_current(fd);
+    if (conn == NULL) {
+        return NULL;
     }
-    return res;
+    return _create_header(&conn->arena, header, list);
 }
 
 void sc_headers_free(sc_headers *headers) {
-    printf("Freeing headers\n");
     while(headers != NULL) {
         sc_headers *next = headers->next;
-        sc_str_free(&headers->header);
-        free(headers);
+        if (!headers->ref) {
+            free(headers);
+        }
         headers = next;
     }
 }
 
 void sc_header_free(sc_headers *header) {
-    if (header != NULL) {
-        sc_str_free(&header->header);
+    if (header != NULL && !header->ref) {
         free(header);
     }
 }
@@ -0,0 +1,235 @@
+#include "sculpt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+
+#define LOG_RING_MASK (SC_LOG_RING_SIZE - 1)
+
+_Static_assert((SC_LOG_RING_SIZE & LOG_RING_MASK) == 0, "SC_LOG_RING_SIZE must be a power of two");
+
+/* one preformatted message. seq tells who owns the slot: it equals the ring position while a logger may claim it,
+ * position + 1 once the message is written, and it is moved a lap ahead when the flush thread is done with it */
+struct log_slot {
+    size_t seq;
+    int fd;
+    int len;
+    char text[SC_LOG_RECORD_SIZE];
+};
+
+struct log_batch {
+    int fd;
+    size_t len;
+    char buf[SC_LOG_BATCH_SIZE];
+};
+
+/* bounded queue shared by every loop of the process. Loggers claim slots with a CAS on head, only the flush thread
+ * reads them, so nothing blocks on the hot path; when the ring is full the message is dropped and counted */
+static struct {
+    struct log_slot slots[SC_LOG_RING_SIZE];
+    size_t head;
+    size_t tail;
+    size_t dropped;
+    struct log_batch batch;     // used by the flush thread, and by _sc_log_stop() once the thread is gone
+
+    bool running;
+    int writers;                // loggers between checking running and publishing their message
+    bool stopping;
+    int users;                  // managers alive, the thread runs while there is one
+    pthread_t thread;
+    pthread_mutex_t lock;       // only taken to start and stop the thread
+} ring = {.batch.fd = STDOUT_FILENO, .lock = PTHREAD_MUTEX_INITIALIZER};
+
+// write()s the whole buffer, the thread is the only writer so partial writes don't interleave with anything
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return;
+        buf += n;
+        len -= n;
+    }
+}
+
+static void batch_flush(struct log_batch *batch) {
+    if (batch->len > 0) {
+        write_all(batch->fd, batch->buf, batch->len);
+        batch->len = 0;
+    }
+}
+
+// messages are gathered per stream, so each write() carries as many of them as fit. A message for the other stream
+// flushes the batch first to keep stdout and stderr in order
+static void batch_add(struct log_batch *batch, int fd, const char *text, size_t len) {
+    if (batch->fd != fd || batch->len + len > sizeof(batch->buf)) {
+        batch_flush(batch);
+        batch->fd = fd;
+    }
+    memcpy(batch->buf + batch->len, text, len);
+    batch->len += len;
+}
+
+// moves every message written so far into the batch, returns how many were taken
+static size_t ring_drain(struct log_batch *batch) {
+    size_t count = 0;
+
+    for (;;) {
+        struct log_slot *slot = &ring.slots[ring.tail & LOG_RING_MASK];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring.tail + 1) break;
+
+        batch_add(batch, slot->fd, slot->text, slot->len);
+        __atomic_store_n(&slot->seq, ring.tail + SC_LOG_RING_SIZE, __ATOMIC_RELEASE);
+        ring.tail++;
+        count++;
+    }
+
+    size_t dropped = __atomic_exchange_n(&ring.dropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0) {
+        char note[64];
+        int len = snprintf(note, sizeof(note), "[Sculpt] Log buffer full, %zu messages dropped\n", dropped);
+        batch_add(batch, STDERR_FILENO, note, len);
+    }
+    return count;
+}
+
+static void *flush_thread(void *arg) {
+    (void) arg;
+    struct log_batch *batch = &ring.batch;
+    const struct timespec interval = {0, SC_LOG_FLUSH_INTERVAL_MS * 1000000L};
+
+    while (!__atomic_load_n(&ring.stopping, __ATOMIC_ACQUIRE)) {
+        if (ring_drain(batch) == 0) {
+            batch_flush(batch);
+            nanosleep(&interval, NULL);
+        }
+    }
+
+    // loggers already went back to writing directly, only what they queued before is left
+    ring_drain(batch);
+    batch_flush(batch);
+    return NULL;
+}
+
+void _sc_log_start(void) {
+    pthread_mutex_lock(&ring.lock);
+    if (ring.users++ == 0) {
+        for (size_t i = 0; i < SC_LOG_RING_SIZE; i++) {
+            // head is where the previous run stopped, its position i slots ahead is not necessarily slot i
+            ring.slots[(ring.head + i) & LOG_RING_MASK].seq = ring.head + i;
+        }
+        ring.tail = ring.head;
+        ring.stopping = false;
+
+        // without the thread, messages are still written, just synchronously
+        if (pthread_create(&ring.thread, NULL, flush_thread, NULL) == 0) {
+            __atomic_store_n(&ring.running, true, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&ring.lock);
+}
+
+void _sc_log_stop(void) {
+    pthread_mutex_lock(&ring.lock);
+    if (--ring.users == 0 && ring.running) {
+        __atomic_store_n(&ring.running, false, __ATOMIC_SEQ_CST);
+        __atomic_store_n(&ring.stopping, true, __ATOMIC_RELEASE);
+        pthread_join(ring.thread, NULL);
+
+        // a logger that saw running just before it was cleared may have queued its message after the last drain
+        while (__atomic_load_n(&ring.writers, __ATOMIC_SEQ_CST) > 0) {
+            sched_yield();
+        }
+        ring_drain(&ring.batch);
+        batch_flush(&ring.batch);
+    }
+    pthread_mutex_unlock(&ring.lock);
+}
+
+// claims the next free slot, or returns NULL if the flush thread fell a whole ring behind
+static struct log_slot *ring_claim(size_t *pos_out) {
+    size_t pos = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        struct log_slot *slot = &ring.slots[pos & LOG_RING_MASK];
+        intptr_t diff = (intptr_t) __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (intptr_t) pos;
+
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&ring.head, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                *pos_out = pos;
+                return slot;
+            }
+        } else if (diff < 0) {
+            __atomic_fetch_add(&ring.dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// messages that didn't fit in a record keep their line end
+static int record_len(char *text, int len) {
+    if (len < 0) return 0;
+    if (len >= SC_LOG_RECORD_SIZE) {
+        len = SC_LOG_RECORD_SIZE - 1;
+        text[len - 1] = '\n';
+    }
+    return len;
+}
+
+static void log_write(int fd, const char *format, va_list args) {
+    // counted before running is read, so _sc_log_stop() can wait for the message to be in the ring
+    __atomic_fetch_add(&ring.writers, 1, __ATOMIC_SEQ_CST);
+    if (!__atomic_load_n(&ring.running, __ATOMIC_SEQ_CST)) {
+        __atomic_fetch_sub(&ring.writers, 1, __ATOMIC_RELEASE);
+        char text[SC_LOG_RECORD_SIZE];
+        int len = record_len(text, vsnprintf(text, sizeof(text), format, args));
+        write_all(fd, text, len);
+        return;
+    }
+
+    size_t pos;
+    struct log_slot *slot = ring_claim(&pos);
+    if (slot != NULL) {
+        slot->fd = fd;
+        slot->len = record_len(slot->text, vsnprintf(slot->text, sizeof(slot->text), format, args));
+        __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    }
+    __atomic_fetch_sub(&ring.writers, 1, __ATOMIC_RELEASE);
+}
+
+// a message is shown when its level is within the manager's one. Without a manager, nothing can be checked
+static bool log_enabled(sc_conn_mgr *mgr, int ll) {
+    return ll != SC_LL_NONE && (mgr == NULL || ll <= mgr->ll);
+}
+
+void _sc_log(sc_conn_mgr *mgr, int ll, int fd, const char *format, ...) {
+    if (!log_enabled(mgr, ll)) return;
+
+    va_list args;
+    va_start(args, format);
+    log_write(fd, format, args);
+    va_end(args);
+}
+
+static void perror_write(int fd, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    log_write(fd, format, args);
+    va_end(args);
+}
+
+void _sc_perror(sc_conn_mgr *mgr, int ll, const char *err) {
+    // errno is read before anything else can change it
+    int saved = errno;
+    if (!log_enabled(mgr, ll)) return;
+
+    char buf[128];
+    perror_write(STDERR_FILENO, "%s: %s\n", err, strerror_r(saved, buf, sizeof(buf)));
+    errno = saved;
+}
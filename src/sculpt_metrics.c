@@ -0,0 +1,338 @@
+#include "sculpt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+/* log-linear histogram of microseconds, with two buckets per power of two: 1, 2, 3, 4, 6, 8, 12, 16, 24...
+ * The last one also holds everything above it. */
+struct _sc_histogram {
+    uint64_t buckets[SC_METRICS_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+};
+
+struct _sc_endpoint_stats {
+    uint64_t requests;
+    uint64_t status[6];         // no status, then 1xx to 5xx
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    struct _sc_histogram parse;
+    struct _sc_histogram handler;
+    struct _sc_histogram write;
+};
+
+/* counters of one loop, indexed by endpoint id. The last entry counts the requests no endpoint matched */
+struct _sc_metrics {
+    struct _sc_endpoint_stats *endpoints;
+    int count;
+};
+
+struct _sc_metrics *_sc_metrics_create(int endpoint_count) {
+    struct _sc_metrics *metrics = malloc(sizeof(struct _sc_metrics));
+    if (metrics == NULL) {
+        return NULL;
+    }
+
+    metrics->count = endpoint_count + 1;
+    metrics->endpoints = calloc(metrics->count, sizeof(struct _sc_endpoint_stats));
+    if (metrics->endpoints == NULL) {
+        free(metrics);
+        return NULL;
+    }
+    return metrics;
+}
+
+void _sc_metrics_destroy(sc_conn_mgr *mgr) {
+    if (mgr->metrics == NULL) return;
+
+    free(mgr->metrics->endpoints);
+    free(mgr->metrics);
+    mgr->metrics = NULL;
+}
+
+int _sc_metrics_grow(sc_conn_mgr *mgr) {
+    struct _sc_metrics *metrics = mgr->metrics;
+    if (metrics == NULL || mgr->endpoint_count < metrics->count) return SC_OK;
+
+    // endpoints are only bound before the loops start, so nothing reads the array while it moves
+    struct _sc_endpoint_stats *endpoints = realloc(metrics->endpoints, (mgr->endpoint_count + 1) * sizeof(struct _sc_endpoint_stats));
+    if (endpoints == NULL) {
+        return SC_MALLOC_ERR;
+    }
+    memset(&endpoints[metrics->count], 0, (mgr->endpoint_count + 1 - metrics->count) * sizeof(struct _sc_endpoint_stats));
+    metrics->endpoints = endpoints;
+    metrics->count = mgr->endpoint_count + 1;
+    return SC_OK;
+}
+
+static int bucket_index(uint32_t us) {
+    if (us <= 1) return 0;
+
+    // us is in (2^h, 2^(h+1)], whose upper half starts above 3 * 2^(h-1)
+    int h = 31 - __builtin_clz(us - 1);
+    int index = h == 0 ? 1 : (us <= (3u << (h - 1)) ? 2 * h : 2 * h + 1);
+    return index < SC_METRICS_BUCKETS ? index : SC_METRICS_BUCKETS - 1;
+}
+
+static uint64_t bucket_bound(int index) {
+    if (index == 0) return 1;
+    int k = (index + 1) / 2;
+    return index % 2 == 1 ? (uint64_t) 1 << k : (uint64_t) 3 << (k - 1);
+}
+
+static void histogram_record(struct _sc_histogram *histogram, uint32_t us) {
+    _SC_STAT_ADD(histogram->buckets[bucket_index(us)], 1);
+    _SC_STAT_ADD(histogram->count, 1);
+    _SC_STAT_ADD(histogram->sum, us);
+}
+
+static struct _sc_endpoint_stats *endpoint_stats(struct _sc_metrics *metrics, int endpoint) {
+    if (endpoint < 0 || endpoint >= metrics->count - 1) {
+        endpoint = metrics->count - 1;
+    }
+    return &metrics->endpoints[endpoint];
+}
+
+void _sc_metrics_request(sc_conn_mgr *mgr, sc_conn *conn, uint32_t parse_us, uint32_t handler_us) {
+    struct _sc_parser *parser = &conn->parser;
+    struct _sc_endpoint_stats *stats = endpoint_stats(mgr->metrics, parser->route ? parser->route->id : -1);
+
+    int status = conn->access.status / 100;
+    if (status < 1 || status > 5) {
+        status = 0;
+    }
+
+    _SC_STAT_ADD(stats->requests, 1);
+    _SC_STAT_ADD(stats->status[status], 1);
+    if (parser->state != SC_PARSE_REQUEST_LINE) {
+        _SC_STAT_ADD(stats->bytes_in, parser->pos + parser->body_read);
+    }
+    histogram_record(&stats->parse, parse_us);
+    histogram_record(&stats->handler, handler_us);
+}
+
+void _sc_metrics_sent(sc_conn_mgr *mgr, int endpoint, uint32_t write_us, uint64_t bytes) {
+    struct _sc_endpoint_stats *stats = endpoint_stats(mgr->metrics, endpoint);
+
+    _SC_STAT_ADD(stats->bytes_out, bytes);
+    if (write_us != UINT32_MAX) {
+        histogram_record(&stats->write, write_us);
+    }
+}
+
+static uint64_t load(const uint64_t *stat) {
+    return __atomic_load_n(stat, __ATOMIC_RELAXED);
+}
+
+static void histogram_add(struct _sc_histogram *total, const struct _sc_histogram *histogram) {
+    for (int i = 0; i < SC_METRICS_BUCKETS; i++) {
+        total->buckets[i] += load(&histogram->buckets[i]);
+    }
+    total->count += load(&histogram->count);
+    total->sum += load(&histogram->sum);
+}
+
+static void endpoint_add(struct _sc_endpoint_stats *total, const struct _sc_endpoint_stats *stats) {
+    total->requests += load(&stats->requests);
+    for (int i = 0; i < 6; i++) {
+        total->status[i] += load(&stats->status[i]);
+    }
+    total->bytes_in += load(&stats->bytes_in);
+    total->bytes_out += load(&stats->bytes_out);
+    histogram_add(&total->parse, &stats->parse);
+    histogram_add(&total->handler, &stats->handler);
+    histogram_add(&total->write, &stats->write);
+}
+
+static void print_histogram(FILE *out, const char *name, const char *label, const struct _sc_histogram *histogram) {
+    uint64_t cumulative = 0;
+    for (int i = 0; i < SC_METRICS_BUCKETS - 1; i++) {
+        cumulative += histogram->buckets[i];
+        fprintf(out, "%s_bucket{%s,le=\"%g\"} %llu\n", name, label, bucket_bound(i) / 1e6, (unsigned long long) cumulative);
+    }
+    fprintf(out, "%s_bucket{%s,le=\"+Inf\"} %llu\n", name, label, (unsigned long long) histogram->count);
+    fprintf(out, "%s_sum{%s} %g\n", name, label, histogram->sum / 1e6);
+    fprintf(out, "%s_count{%s} %llu\n", name, label, (unsigned long long) histogram->count);
+}
+
+// label of an endpoint, "unmatched" for NULL. Endpoints are paths, only quotes and backslashes need escaping
+static void endpoint_label(char *label, size_t size, const struct _endpoint_list *endpoint) {
+    size_t n = snprintf(label, size, "endpoint=\"");
+    if (endpoint == NULL) {
+        n += snprintf(label + n, size - n, "unmatched");
+    }
+    for (size_t i = 0; endpoint != NULL && i < endpoint->val.len && n + 3 < size; i++) {
+        char c = endpoint->val.buf[i];
+        if (c == '"' || c == '\\') {
+            label[n++] = '\\';
+        }
+        label[n++] = c == '\n' ? ' ' : c;
+    }
+    snprintf(label + n, size - n, "\"");
+}
+
+// one counter family, with a sample per endpoint
+static void print_counter(FILE *out, const char *name, char (*labels)[SC_ENDPOINT_LEN * 2 + 16],
+                          const struct _sc_endpoint_stats *totals, int count, size_t field) {
+    fprintf(out, "# TYPE %s counter\n", name);
+    for (int id = 0; id < count; id++) {
+        if (labels[id][0] == '\0') continue;
+        const uint64_t *value = (const uint64_t *) ((const char *) &totals[id] + field);
+        fprintf(out, "%s{%s} %llu\n", name, labels[id], (unsigned long long) *value);
+    }
+}
+
+static void print_histograms(FILE *out, const char *name, char (*labels)[SC_ENDPOINT_LEN * 2 + 16],
+                             const struct _sc_endpoint_stats *totals, int count, size_t field) {
+    fprintf(out, "# TYPE %s histogram\n", name);
+    for (int id = 0; id < count; id++) {
+        if (labels[id][0] == '\0') continue;
+        print_histogram(out, name, labels[id], (const struct _sc_histogram *) ((const char *) &totals[id] + field));
+    }
+}
+
+// prints the endpoint families. Each one is printed whole, as the text format doesn't allow mixing them
+static int print_endpoints(FILE *out, sc_conn_mgr **loop, int loops) {
+    static const char *classes[6] = {"none", "1xx", "2xx", "3xx", "4xx", "5xx"};
+    sc_conn_mgr *root = loop[0];
+    int count = root->metrics->count;
+
+    struct _sc_endpoint_stats *totals = calloc(count, sizeof(struct _sc_endpoint_stats));
+    char (*labels)[SC_ENDPOINT_LEN * 2 + 16] = calloc(count, sizeof(*labels));
+    if (totals == NULL || labels == NULL) {
+        free(totals);
+        free(labels);
+        return SC_MALLOC_ERR;
+    }
+
+    for (int id = 0; id < count; id++) {
+        for (int i = 0; i < loops; i++) {
+            if (loop[i]->metrics != NULL && id < loop[i]->metrics->count) {
+                endpoint_add(&totals[id], &loop[i]->metrics->endpoints[id]);
+            }
+        }
+    }
+
+    // the unmatched requests are counted last, endpoints that were replaced by a later bind have no label
+    for (const struct _endpoint_list *current = root->endpoints; current != NULL; current = current->next) {
+        if (current->id < count - 1 && labels[current->id][0] == '\0') {
+            endpoint_label(labels[current->id], sizeof(labels[0]), current);
+        }
+    }
+    endpoint_label(labels[count - 1], sizeof(labels[0]), NULL);
+
+    print_counter(out, "sculpt_requests_total", labels, totals, count, offsetof(struct _sc_endpoint_stats, requests));
+
+    fprintf(out, "# TYPE sculpt_responses_total counter\n");
+    for (int id = 0; id < count; id++) {
+        if (labels[id][0] == '\0') continue;
+        for (int i = 0; i < 6; i++) {
+            fprintf(out, "sculpt_responses_total{%s,code=\"%s\"} %llu\n", labels[id], classes[i],
+                    (unsigned long long) totals[id].status[i]);
+        }
+    }
+
+    print_counter(out, "sculpt_request_bytes_total", labels, totals, count, offsetof(struct _sc_endpoint_stats, bytes_in));
+    print_counter(out, "sculpt_response_bytes_total", labels, totals, count, offsetof(struct _sc_endpoint_stats, bytes_out));
+    print_histograms(out, "sculpt_parse_seconds", labels, totals, count, offsetof(struct _sc_endpoint_stats, parse));
+    print_histograms(out, "sculpt_handler_seconds", labels, totals, count, offsetof(struct _sc_endpoint_stats, handler));
+    print_histograms(out, "sculpt_write_seconds", labels, totals, count, offsetof(struct _sc_endpoint_stats, write));
+
+    free(totals);
+    free(labels);
+    return SC_OK;
+}
+
+static int print_metrics(FILE *out, sc_conn_mgr *root) {
+    // the workers list is filled before each worker is counted
+    int worker_count = __atomic_load_n(&root->worker_count, __ATOMIC_ACQUIRE);
+    int loops = worker_count + 1;
+    sc_conn_mgr *loop[loops];
+    loop[0] = root;
+    for (int i = 0; i < worker_count; i++) {
+        loop[i + 1] = root->workers[i];
+    }
+
+    struct _sc_loop_stats stats = {0};
+    long long conns = 0, max_conns = 0;
+    for (int i = 0; i < loops; i++) {
+        stats.polls += load(&loop[i]->stats.polls);
+        stats.events += load(&loop[i]->stats.events);
+        stats.accepted += load(&loop[i]->stats.accepted);
+        stats.rejected += load(&loop[i]->stats.rejected);
+        stats.timeouts += load(&loop[i]->stats.timeouts);
+        stats.allocated += load(&loop[i]->stats.allocated);
+        stats.shed += load(&loop[i]->stats.shed);
+        stats.handed_off += load(&loop[i]->stats.handed_off);
+        conns += __atomic_load_n(&loop[i]->conn_count, __ATOMIC_RELAXED);
+        max_conns += loop[i]->max_conn_count;
+    }
+
+    fprintf(out, "# TYPE sculpt_loops gauge\nsculpt_loops %d\n", loops);
+    fprintf(out, "# TYPE sculpt_connections gauge\nsculpt_connections %lld\n", conns);
+    fprintf(out, "# TYPE sculpt_connections_free gauge\nsculpt_connections_free %lld\n", max_conns - conns);
+    fprintf(out, "# TYPE sculpt_connections_allocated gauge\nsculpt_connections_allocated %llu\n",
+            (unsigned long long) stats.allocated);
+    fprintf(out, "# TYPE sculpt_connections_accepted_total counter\nsculpt_connections_accepted_total %llu\n",
+            (unsigned long long) stats.accepted);
+    fprintf(out, "# TYPE sculpt_connections_rejected_total counter\nsculpt_connections_rejected_total %llu\n",
+            (unsigned long long) stats.rejected);
+    fprintf(out, "# TYPE sculpt_connections_shed_total counter\nsculpt_connections_shed_total %llu\n",
+            (unsigned long long) stats.shed);
+    fprintf(out, "# TYPE sculpt_connections_handed_off_total counter\nsculpt_connections_handed_off_total %llu\n",
+            (unsigned long long) stats.handed_off);
+    fprintf(out, "# TYPE sculpt_connection_timeouts_total counter\nsculpt_connection_timeouts_total %llu\n",
+            (unsigned long long) stats.timeouts);
+    fprintf(out, "# TYPE sculpt_polls_total counter\nsculpt_polls_total %llu\n", (unsigned long long) stats.polls);
+    fprintf(out, "# TYPE sculpt_poll_events_total counter\nsculpt_poll_events_total %llu\n", (unsigned long long) stats.events);
+    fprintf(out, "# TYPE sculpt_poll_last_batch gauge\n");
+    for (int i = 0; i < loops; i++) {
+        fprintf(out, "sculpt_poll_last_batch{loop=\"%d\"} %llu\n", i, (unsigned long long) load(&loop[i]->stats.last_batch));
+    }
+    fprintf(out, "# TYPE sculpt_loop_lag_seconds gauge\n");
+    for (int i = 0; i < loops; i++) {
+        fprintf(out, "sculpt_loop_lag_seconds{loop=\"%d\"} %.6f\n", i, load(&loop[i]->stats.lag_ns) / 1e9);
+    }
+
+    return print_endpoints(out, loop, loops);
+}
+
+void _sc_metrics_serve(sc_conn_mgr *mgr, int fd) {
+    sc_conn_mgr *root = mgr->parent != NULL ? mgr->parent : mgr;
+
+    char *body = NULL;
+    size_t len = 0;
+    FILE *out = open_memstream(&body, &len);
+    if (out == NULL) {
+        sc_easy_send(fd, 500, "Internal Server Error", NULL, "", NULL);
+        return;
+    }
+    int rc = print_metrics(out, root);
+    fclose(out);
+
+    if (rc != SC_OK) {
+        sc_easy_send(fd, 500, "Internal Server Error", NULL, "", NULL);
+    } else {
+        sc_easy_send_n(fd, 200, "OK", "Content-Type: text/plain; version=0.0.4", body, len, NULL);
+    }
+    free(body);
+}
+
+int sc_mgr_metrics_enable(sc_conn_mgr *mgr, const char *endpoint) {
+    if (mgr == NULL || endpoint == NULL || mgr->parent != NULL || mgr->worker_count > 0) return SC_BAD_ARGUMENTS_ERR;
+    if (mgr->metrics != NULL) return SC_OK;
+
+    int rc = _sc_mgr_bind(mgr, endpoint, false, NULL);
+    if (rc != SC_OK) {
+        return rc;
+    }
+    mgr->endpoints->metrics = true;
+
+    mgr->metrics = _sc_metrics_create(mgr->endpoint_count);
+    if (mgr->metrics == NULL) {
+        return SC_MALLOC_ERR;
+    }
+    return SC_OK;
+}
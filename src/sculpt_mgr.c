@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <sys/socket.h>
 #include <string.h>
+#include <pthread.h>
 
 sc_addr_info sc_addr_create(int sin_family, int port) {
     sc_addr_info addr_mgr;
@@ -16,21 +17,71 @@ sc_conn_mgr *sc_mgr_create(sc_addr_info addr_mgr, int *err) {
     *err = SC_OK;
     sc_conn_mgr *mgr = malloc(sizeof(sc_conn_mgr));
     if (mgr == NULL) {
-        perror("[Sculpt] Error: memory allocation for sc_conn_mgr");
+        sc_perror(NULL, SC_LL_MINIMAL, "[Sculpt] Error: memory allocation for sc_conn_mgr");
         *err = SC_MALLOC_ERR;
         return NULL;
     }
+    _sc_log_start();
 
     mgr->addr_info = addr_mgr;
     mgr->backlog = SC_DEFAULT_BACKLOG;
     mgr->max_events = SC_DEFAULT_EPOLL_MAXEVENTS;
+    mgr->accept_budget = SC_DEFAULT_ACCEPT_BUDGET;
+    mgr->listener_et = false;
+    mgr->accept_pending = false;
+    mgr->write_high_water = SC_DEFAULT_WRITE_HIGH_WATER;
+    mgr->max_body_size = SC_DEFAULT_MAX_BODY_SIZE;
+    mgr->lag_target_ns = 0;
+    mgr->shed_mode = SC_SHED_REJECT;
+    mgr->shedding = false;
+    mgr->behind = false;
+    mgr->behind_since = 0;
+    mgr->event_ns = 0;
+    mgr->admitted = 0;
+    mgr->handoff = NULL;
+    mgr->draining = false;
+    mgr->drained = false;
     mgr->listening = false;
+    mgr->ll = SC_LL_NORMAL;
+    mgr->now = _sc_clock_now();
+    _sc_timer_wheel_init(&mgr->timers, mgr->now);
     mgr->epoll_fd = -1;
+    mgr->events = NULL;
+    mgr->backend = SC_BACKEND_EPOLL;
+    mgr->uring = NULL;
+    mgr->slabs = NULL;
+    mgr->slab_count = 0;
+    mgr->slabs_allocated = 0;
+    mgr->open_slabs = NULL;
+    mgr->open_slabs_tail = NULL;
+    mgr->pool_checked = 0;
+    mgr->max_conn_count = 0;
+    mgr->conn_count = 0;
     mgr->endpoints = NULL;
+    mgr->routes = NULL;
+    mgr->files = NULL;
+    mgr->access_log = NULL;
+    mgr->metrics = NULL;
+    mgr->stats = (struct _sc_loop_stats) {0};
+    mgr->endpoint_count = 0;
+    mgr->response_404 = sc_str_ref_n(NULL, 0);
+    mgr->response_404_close = sc_str_ref_n(NULL, 0);
+    mgr->response_500 = sc_str_ref_n(NULL, 0);
+    mgr->response_503 = sc_str_ref_n(NULL, 0);
+    mgr->response_413 = sc_str_ref_n(NULL, 0);
+    mgr->response_400 = sc_str_ref_n(NULL, 0);
+    mgr->response_431 = sc_str_ref_n(NULL, 0);
+    mgr->response_501 = sc_str_ref_n(NULL, 0);
+    mgr->parent = NULL;
+    mgr->workers = NULL;
+    mgr->threads = NULL;
+    mgr->worker_count = 0;
+    mgr->stopping = false;
 
     mgr->fd = socket(AF_INET, SOCK_STREAM, 0);
     if (mgr->fd < 0) {
-        perror("[Sculpt] Error: error creating socket for conn_mgr");
+        sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error: error creating socket for conn_mgr");
+        _sc_log_stop();
         free(mgr);
         *err = SC_SOCKET_CREATION_ERR;
         return NULL;
@@ -38,21 +89,48 @@ sc_conn_mgr *sc_mgr_create(sc_addr_info addr_mgr, int *err) {
     
     int opt = 1;
     if (setsockopt(mgr->fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(int)) < 0) {
-        perror("[Sculpt] Error: failed to set socket options");
+        sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error: failed to set socket options");
+        *err = SC_SOCKET_SETOPT_ERR;
+        goto error;
+    }
+
+    // lets the worker loops of sc_mgr_run_threads() bind their own listening socket to the same address
+    if (setsockopt(mgr->fd, SOL_SOCKET, SO_REUSEPORT, &opt, sizeof(int)) < 0) {
+        sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error: failed to set SO_REUSEPORT");
         *err = SC_SOCKET_SETOPT_ERR;
         goto error;
     }
 
     if (bind(mgr->fd, (struct sockaddr *)&mgr->addr_info, sizeof(mgr->addr_info))) {
-        perror("[Sculpt] Error: Failed to bind server to the address");
+        sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error: Failed to bind server to the address");
         *err = SC_SOCKET_BIND_ERR;
         goto error;
     }
 
+    if (sc_mgr_err_response_set(mgr, 404, "Content-Type: text/html; charset=UTF-8", "NOT FOUND") != SC_OK
+        || sc_mgr_err_response_set(mgr, 500, "Content-Type: text/html; charset=UTF-8", "Internal Server Error") != SC_OK
+        || sc_mgr_err_response_set(mgr, 503, "Content-Type: text/plain; charset=UTF-8", "Server at capacity") != SC_OK
+        || sc_mgr_err_response_set(mgr, 413, "Content-Type: text/plain; charset=UTF-8", "Request body too large") != SC_OK
+        || sc_mgr_err_response_set(mgr, 400, "Content-Type: text/plain; charset=UTF-8", "Bad request") != SC_OK
+        || sc_mgr_err_response_set(mgr, 431, "Content-Type: text/plain; charset=UTF-8", "Request header fields too large") != SC_OK
+        || sc_mgr_err_response_set(mgr, 501, "Content-Type: text/plain; charset=UTF-8", "Transfer-Encoding not implemented") != SC_OK) {
+        *err = SC_MALLOC_ERR;
+        goto error;
+    }
+
     return mgr;
 
     error:
+        free(mgr->response_404.buf);
+        free(mgr->response_404_close.buf);
+        free(mgr->response_500.buf);
+        free(mgr->response_503.buf);
+        free(mgr->response_413.buf);
+        free(mgr->response_400.buf);
+        free(mgr->response_431.buf);
+        free(mgr->response_501.buf);
         close(mgr->fd);
+        _sc_log_stop();
         free(mgr);
         return NULL;
 }
@@ -69,9 +147,117 @@ void sc_mgr_ll_set(sc_conn_mgr *mgr, int ll) {
     mgr->ll = ll;
 }
 
+void sc_mgr_accept_budget_set(sc_conn_mgr *mgr, int budget) {
+    mgr->accept_budget = budget > 0 ? budget : 1;
+}
+
+int sc_mgr_backend_set(sc_conn_mgr *mgr, int backend) {
+    if (mgr == NULL || mgr->epoll_fd >= 0 || mgr->uring != NULL) return SC_BAD_ARGUMENTS_ERR;
+    if (backend != SC_BACKEND_EPOLL && backend != SC_BACKEND_IO_URING) return SC_BAD_ARGUMENTS_ERR;
+#ifndef SC_IO_URING
+    if (backend == SC_BACKEND_IO_URING) return SC_IO_URING_ERR;
+#endif
+    mgr->backend = backend;
+    return SC_OK;
+}
+
+int sc_mgr_overload_set(sc_conn_mgr *mgr, int lag_ms, int mode) {
+    if (mgr == NULL || lag_ms < 0 || mgr->worker_count > 0) return SC_BAD_ARGUMENTS_ERR;
+    if (mode != SC_SHED_REJECT && mode != SC_SHED_DEFER) return SC_BAD_ARGUMENTS_ERR;
+    mgr->lag_target_ns = (uint64_t) lag_ms * 1000000;
+    mgr->shed_mode = mode;
+    return SC_OK;
+}
+
+void sc_mgr_write_high_water_set(sc_conn_mgr *mgr, size_t bytes) {
+    mgr->write_high_water = bytes;
+}
+
+void sc_mgr_max_body_size_set(sc_conn_mgr *mgr, size_t bytes) {
+    mgr->max_body_size = bytes;
+}
+
+int sc_mgr_err_response_set(sc_conn_mgr *mgr, int code, const char *content_type, const char *body) {
+    if (mgr == NULL || body == NULL || mgr->parent != NULL || mgr->worker_count > 0) return SC_BAD_ARGUMENTS_ERR;
+
+    sc_str *response;
+    sc_str *response_close = NULL;
+    const char *code_str;
+    sc_headers retry_after = {sc_str_ref("Retry-After: " SC_RETRY_AFTER), true, NULL};
+    sc_headers *headers = NULL;
+    switch (code) {
+        case 404:
+            response = &mgr->response_404;
+            response_close = &mgr->response_404_close;
+            code_str = "NOT FOUND";
+            break;
+        case 500:
+            response = &mgr->response_500;
+            code_str = "Internal Server Error";
+            break;
+        case 503:
+            response = &mgr->response_503;
+            code_str = "Service Unavailable";
+            headers = &retry_after;
+            break;
+        case 413:
+            response = &mgr->response_413;
+            code_str = "Content Too Large";
+            break;
+        case 400:
+            response = &mgr->response_400;
+            code_str = "Bad Request";
+            break;
+        case 431:
+            response = &mgr->response_431;
+            code_str = "Request Header Fields Too Large";
+            break;
+        case 501:
+            response = &mgr->response_501;
+            code_str = "Not Implemented";
+            break;
+        default:
+            return SC_BAD_ARGUMENTS_ERR;
+    }
+
+    // the connection is closed after any of them but the 404, which keeps it open unless the request said otherwise
+    sc_str serialized;
+    sc_str serialized_close = sc_str_ref_n(NULL, 0);
+    int rc = _sc_response_serialize(&serialized, code, code_str, content_type, body, strlen(body), headers,
+                                    response_close != NULL);
+    if (rc == SC_OK && response_close != NULL) {
+        rc = _sc_response_serialize(&serialized_close, code, code_str, content_type, body, strlen(body), headers, false);
+        if (rc != SC_OK) {
+            free(serialized.buf);
+        }
+    }
+    if (rc != SC_OK) {
+        return rc;
+    }
+    free(response->buf);
+    *response = serialized;
+    if (response_close != NULL) {
+        free(response_close->buf);
+        *response_close = serialized_close;
+    }
+    return SC_OK;
+}
+
+int sc_mgr_listener_et_set(sc_conn_mgr *mgr, bool et) {
+    mgr->listener_et = et;
+    if (mgr->epoll_fd < 0) return SC_OK; // applied by sc_mgr_epoll_init()
+
+    mgr->epoll_event.events = EPOLLIN | EPOLLRDHUP | (et ? EPOLLET : 0);
+    if (epoll_ctl(mgr->epoll_fd, EPOLL_CTL_MOD, mgr->fd, &mgr->epoll_event) == -1) {
+        sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Failed to change listener epoll mode");
+        return SC_EPOLL_CTL_ERR;
+    }
+    return SC_OK;
+}
+
 int sc_mgr_listen(sc_conn_mgr *mgr) {
     if (listen(mgr->fd, mgr->backlog) < 0) {
-        perror("Error: error in listen()");
+        sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error: error in listen()");
         return SC_SOCKET_LISTEN_ERR;
     }
 
@@ -79,27 +265,203 @@ int sc_mgr_listen(sc_conn_mgr *mgr) {
                         mgr->host_buf, sizeof(mgr->host_buf),
                         mgr->service_buf, sizeof(mgr->service_buf), 0);
     if (rc != 0) {
-        fprintf(stderr, "[Sculpt] Warning: %s; ", gai_strerror(rc));
-        fprintf(stderr, "Server is listening on unknown URL\n");
+        sc_error_log(mgr, SC_LL_NORMAL, "[Sculpt] Warning: %s; Server is listening on unknown URL\n", gai_strerror(rc));
         return SC_SOCKET_GETNAMEINFO_ERR;
     }
 
-    printf("\n[Sculpt] Server is listening on http://%s%s:%d\n", mgr->host_buf, mgr->service_buf, mgr->addr_info.port);
+    sc_log(mgr, SC_LL_NORMAL, "\n[Sculpt] Server is listening on http://%s%s:%d\n", mgr->host_buf, mgr->service_buf, mgr->addr_info.port);
 
     mgr->listening = true;
     return SC_OK;
 }
 
+static void *worker_loop(void *arg) {
+    sc_conn_mgr *worker = arg;
+
+    while (!__atomic_load_n(&worker->parent->stopping, __ATOMIC_ACQUIRE)) {
+        int rc = sc_mgr_poll(worker, SC_WORKER_POLL_TIMEOUT);
+        if (rc != SC_OK) {
+            sc_error_log(worker, SC_LL_NORMAL, "[Sculpt] Worker loop poll error: %d\n", rc);
+        }
+    }
+    return NULL;
+}
+
+// creates a loop sharing the main loop settings and endpoints, with its own socket, epoll and connection pool
+static sc_conn_mgr *create_worker(sc_conn_mgr *mgr, int index, int max_conns, int *err) {
+    sc_conn_mgr *worker = sc_mgr_create(mgr->addr_info, err);
+    if (worker == NULL) {
+        return NULL;
+    }
+
+    worker->parent = mgr;
+    worker->backlog = mgr->backlog;
+    worker->max_events = mgr->max_events;
+    worker->accept_budget = mgr->accept_budget;
+    worker->listener_et = mgr->listener_et;
+    worker->backend = mgr->uring != NULL ? SC_BACKEND_IO_URING : SC_BACKEND_EPOLL;
+    worker->write_high_water = mgr->write_high_water;
+    worker->max_body_size = mgr->max_body_size;
+    worker->lag_target_ns = mgr->lag_target_ns;
+    worker->shed_mode = mgr->shed_mode;
+    worker->ll = mgr->ll;
+    worker->endpoints = mgr->endpoints;
+    worker->routes = mgr->routes;
+
+    // the error responses are borrowed from the main loop too
+    free(worker->response_404.buf);
+    free(worker->response_404_close.buf);
+    free(worker->response_500.buf);
+    free(worker->response_503.buf);
+    free(worker->response_413.buf);
+    free(worker->response_400.buf);
+    free(worker->response_431.buf);
+    free(worker->response_501.buf);
+    worker->response_404 = mgr->response_404;
+    worker->response_404_close = mgr->response_404_close;
+    worker->response_500 = mgr->response_500;
+    worker->response_503 = mgr->response_503;
+    worker->response_413 = mgr->response_413;
+    worker->response_400 = mgr->response_400;
+    worker->response_431 = mgr->response_431;
+    worker->response_501 = mgr->response_501;
+
+    if (mgr->metrics != NULL) {
+        worker->metrics = _sc_metrics_create(mgr->endpoint_count);
+        if (worker->metrics == NULL) {
+            *err = SC_MALLOC_ERR;
+            sc_mgr_finish(worker);
+            return NULL;
+        }
+    }
+
+    // each loop writes its own access log file, next to the main loop one
+    if (mgr->access_log != NULL) {
+        worker->access_log = _sc_access_log_worker(mgr, index, err);
+        if (worker->access_log == NULL) {
+            sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error: failed to open the access log of a worker loop");
+            sc_mgr_finish(worker);
+            return NULL;
+        }
+    }
+
+    // after a takeover, the worker serves the clients queued on a listening socket of the old process
+    _sc_handoff_worker(mgr, worker);
+    if (listen(worker->fd, worker->backlog) < 0) {
+        sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error: error in listen() for worker loop");
+        *err = SC_SOCKET_LISTEN_ERR;
+        sc_mgr_finish(worker);
+        return NULL;
+    }
+    worker->listening = true;
+
+    *err = sc_mgr_epoll_init(worker);
+    if (*err == SC_OK) {
+        *err = sc_mgr_conn_pool_init(worker, max_conns);
+    }
+    if (*err != SC_OK) {
+        sc_mgr_finish(worker);
+        return NULL;
+    }
+    worker->conn_timeout = mgr->conn_timeout;
+    worker->conn_max_age = mgr->conn_max_age;
+
+    return worker;
+}
+
+static void stop_workers(sc_conn_mgr *mgr) {
+    __atomic_store_n(&mgr->stopping, true, __ATOMIC_RELEASE);
+
+    // all of them are stopped before any is freed, as the metrics endpoint of a loop reads the others
+    for (int i = 0; i < mgr->worker_count; i++) {
+        pthread_join(mgr->threads[i], NULL);
+    }
+    for (int i = 0; i < mgr->worker_count; i++) {
+        sc_mgr_finish(mgr->workers[i]);
+    }
+
+    free(mgr->workers);
+    free(mgr->threads);
+    mgr->workers = NULL;
+    mgr->threads = NULL;
+    mgr->worker_count = 0;
+}
+
+int sc_mgr_run_threads(sc_conn_mgr *mgr, int n) {
+    if (mgr == NULL || n < 1 || mgr->parent != NULL || mgr->worker_count > 0) return SC_BAD_ARGUMENTS_ERR;
+    if (!mgr->listening || (mgr->epoll_fd < 0 && mgr->uring == NULL) || mgr->slabs == NULL) {
+        return SC_BAD_ARGUMENTS_ERR;
+    }
+    if (n == 1) return SC_OK;
+
+    int slice = mgr->max_conn_count / n;
+    if (slice < 1) {
+        slice = 1;
+    }
+
+    // the main loop keeps its own slice of the pool, as long as it didn't accept anything yet
+    if (mgr->conn_count == 0) {
+        time_t conn_timeout = mgr->conn_timeout;
+        time_t conn_max_age = mgr->conn_max_age;
+        sc_mgr_conn_pool_destroy(mgr);
+        int rc = sc_mgr_conn_pool_init(mgr, slice);
+        if (rc != SC_OK) {
+            return rc;
+        }
+        mgr->conn_timeout = conn_timeout;
+        mgr->conn_max_age = conn_max_age;
+    }
+
+    mgr->workers = calloc(n - 1, sizeof(sc_conn_mgr *));
+    mgr->threads = calloc(n - 1, sizeof(pthread_t));
+    if (mgr->workers == NULL || mgr->threads == NULL) {
+        free(mgr->workers);
+        free(mgr->threads);
+        mgr->workers = NULL;
+        mgr->threads = NULL;
+        return SC_MALLOC_ERR;
+    }
+    mgr->stopping = false;
+
+    for (int i = 0; i < n - 1; i++) {
+        int err;
+        sc_conn_mgr *worker = create_worker(mgr, i + 1, slice, &err);
+        if (worker == NULL) {
+            stop_workers(mgr);
+            return err;
+        }
+
+        if (pthread_create(&mgr->threads[i], NULL, worker_loop, worker) != 0) {
+            sc_error_log(mgr, SC_LL_MINIMAL, "[Sculpt] Error: failed to start worker loop thread\n");
+            sc_mgr_finish(worker);
+            stop_workers(mgr);
+            return SC_THREAD_CREATION_ERR;
+        }
+        mgr->workers[i] = worker;
+        // the metrics endpoint of a running loop may read the list, the worker is only counted once it is set
+        __atomic_store_n(&mgr->worker_count, mgr->worker_count + 1, __ATOMIC_RELEASE);
+    }
+
+    sc_log(mgr, SC_LL_NORMAL, "[Sculpt] Started %d event loops\n", n);
+    return SC_OK;
+}
+
 void sc_mgr_finish(sc_conn_mgr *mgr) {
     if (!mgr) {
         return;
     }
-    int ll = mgr->ll;
+    stop_workers(mgr);
 
+    // before the pool, as sends in flight read from the connection buffers
+    _sc_uring_destroy(mgr);
     sc_mgr_conn_pool_destroy(mgr);
-    if (ll == SC_LL_DEBUG) {
-        printf("[Sculpt]freed conn pool\n");
-    }
+    sc_log(mgr, SC_LL_DEBUG, "[Sculpt]freed conn pool\n");
+
+    // after the pool, as connections still sending a file hold a reference to it
+    _sc_file_cache_destroy(mgr);
+    _sc_access_log_destroy(mgr);
+    _sc_metrics_destroy(mgr);
+    _sc_handoff_destroy(mgr);
 
     // close epoll fd and free events array
     if (mgr->epoll_fd >= 0) {
@@ -109,24 +471,37 @@ void sc_mgr_finish(sc_conn_mgr *mgr) {
     free(mgr->events);
     mgr->events = NULL; // !! dangling pointers
 
-    printf("[Sculpt]freed epoll\n");
+    sc_log(mgr, SC_LL_DEBUG, "[Sculpt]freed epoll\n");
 
     // close server socket
     if (mgr->fd >= 0) {
         close(mgr->fd);
         mgr->fd = -1;
     }
-    if (ll == SC_LL_DEBUG) {
-        printf("[Sculpt]freed server socket\n");
-     }
+    sc_log(mgr, SC_LL_DEBUG, "[Sculpt]freed server socket\n");
 
-    // free endpoints list
-    while(mgr->endpoints) {
+    // free endpoints list and routes, which worker loops only borrow from the main loop
+    if (mgr->parent == NULL) {
+        _sc_route_free(mgr->routes);
+        free(mgr->response_404.buf);
+        free(mgr->response_404_close.buf);
+        free(mgr->response_500.buf);
+        free(mgr->response_503.buf);
+        free(mgr->response_413.buf);
+        free(mgr->response_400.buf);
+        free(mgr->response_431.buf);
+        free(mgr->response_501.buf);
+    }
+    while(mgr->parent == NULL && mgr->endpoints) {
         struct _endpoint_list *next = mgr->endpoints->next;
+        free(mgr->endpoints->dir);
+        free(mgr->endpoints->response.buf);
+        free(mgr->endpoints->response_close.buf);
         free(mgr->endpoints);
         mgr->endpoints = next;
     }
     free(mgr);
+    _sc_log_stop();
 }
 
 struct _endpoint_list *_endpoint_add(struct _endpoint_list *list, const char *endpoint, bool soft, void (*func)(int, sc_http_msg, sc_headers*)) {
@@ -137,27 +512,88 @@ struct _endpoint_list *_endpoint_add(struct _endpoint_list *list, const char *en
 
     new->soft = soft;
     new->func = func;
+    new->dir = NULL;
+    new->response = sc_str_ref_n(NULL, 0);
+    new->response_close = sc_str_ref_n(NULL, 0);
+    new->body = NULL;
+    new->metrics = false;
+    new->id = 0;
     sc_str val = sc_str_ref_n(endpoint, strlen(endpoint));
     new->val = val;
     new->next = list;
     return new;
 }
 
-int sc_mgr_bind_hard(sc_conn_mgr *mgr, const char *endpoint, void (*f)(int, sc_http_msg, sc_headers*)) {
-    mgr->endpoints = _endpoint_add(mgr->endpoints, endpoint, false, f);
-    if (mgr->endpoints == NULL) {
-       return SC_MALLOC_ERR;
+int _sc_mgr_bind(sc_conn_mgr *mgr, const char *endpoint, bool soft, void (*f)(int, sc_http_msg, sc_headers*)) {
+    struct _endpoint_list *endpoints = _endpoint_add(mgr->endpoints, endpoint, soft, f);
+    if (endpoints == NULL) {
+        return SC_MALLOC_ERR;
     }
+    mgr->endpoints = endpoints;
+    endpoints->id = mgr->endpoint_count++;
+    if (_sc_metrics_grow(mgr) != SC_OK) {
+        return SC_MALLOC_ERR;
+    }
+
+    if (_sc_route_insert(&mgr->routes, endpoints) != SC_OK) {
+        sc_error_log(mgr, SC_LL_MINIMAL, "[Sculpt] Error: failed to add route for %s\n", endpoint);
+        return SC_MALLOC_ERR;
+    }
+    sc_log(mgr, SC_LL_DEBUG, "[Sculpt]Endpoint added: %s\n", endpoint);
     return SC_OK;
 }
 
+int sc_mgr_bind_hard(sc_conn_mgr *mgr, const char *endpoint, void (*f)(int, sc_http_msg, sc_headers*)) {
+    return _sc_mgr_bind(mgr, endpoint, false, f);
+}
+
 int sc_mgr_bind_soft(sc_conn_mgr *mgr, const char *endpoint, void (*f)(int, sc_http_msg, sc_headers*)) {
-    mgr->endpoints = _endpoint_add(mgr->endpoints, endpoint, true, f);
-    if (mgr->ll == SC_LL_DEBUG) {
-        printf("[Sculpt]Endpoint added: %s", mgr->endpoints->val.buf);
+    return _sc_mgr_bind(mgr, endpoint, true, f);
+}
+
+static int bind_body(sc_conn_mgr *mgr, const char *endpoint, bool soft, void (*f)(int, sc_http_msg, sc_headers*, sc_str)) {
+    if (mgr == NULL || endpoint == NULL || f == NULL) return SC_BAD_ARGUMENTS_ERR;
+
+    int rc = _sc_mgr_bind(mgr, endpoint, soft, NULL);
+    if (rc != SC_OK) {
+        return rc;
     }
-    if (mgr->endpoints == NULL) {
-        return SC_MALLOC_ERR;
+    mgr->endpoints->body = f;
+    return SC_OK;
+}
+
+int sc_mgr_bind_body_hard(sc_conn_mgr *mgr, const char *endpoint, void (*f)(int, sc_http_msg, sc_headers*, sc_str)) {
+    return bind_body(mgr, endpoint, false, f);
+}
+
+int sc_mgr_bind_body_soft(sc_conn_mgr *mgr, const char *endpoint, void (*f)(int, sc_http_msg, sc_headers*, sc_str)) {
+    return bind_body(mgr, endpoint, true, f);
+}
+
+int sc_mgr_bind_static(sc_conn_mgr *mgr, const char *endpoint, int code, const char *code_str,
+                       const char *content_type, const char *body, sc_headers *headers) {
+    if (mgr == NULL || endpoint == NULL || code_str == NULL || body == NULL) {
+        sc_headers_free(headers);
+        return SC_BAD_ARGUMENTS_ERR;
+    }
+
+    // both Connection variants, the one matching the request is sent
+    sc_str response;
+    sc_str response_close = sc_str_ref_n(NULL, 0);
+    int rc = _sc_response_serialize(&response, code, code_str, content_type, body, strlen(body), headers, true);
+    if (rc == SC_OK) {
+        rc = _sc_response_serialize(&response_close, code, code_str, content_type, body, strlen(body), headers, false);
+    }
+    sc_headers_free(headers);
+    if (rc == SC_OK) {
+        rc = _sc_mgr_bind(mgr, endpoint, false, NULL);
+    }
+    if (rc != SC_OK) {
+        free(response.buf);
+        free(response_close.buf);
+        return rc;
     }
+    mgr->endpoints->response = response;
+    mgr->endpoints->response_close = response_close;
     return SC_OK;
 }
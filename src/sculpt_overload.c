@@ -0,0 +1,67 @@
+#include "sculpt.h"
+
+uint64_t _sc_overload_begin(sc_conn_mgr *mgr) {
+    if (mgr->lag_target_ns == 0) return 0;
+
+    // the last batch left nothing behind, so the events of this one only waited since now
+    uint64_t now = _sc_clock_ns();
+    if (!mgr->behind) {
+        mgr->behind_since = now;
+        mgr->admitted = 0;
+    }
+    return now;
+}
+
+bool _sc_overload_update(sc_conn_mgr *mgr, uint64_t start_ns, int events, bool behind) {
+    if (mgr->lag_target_ns == 0) return false;
+
+    uint64_t now = _sc_clock_ns();
+    if (events > 0) {
+        uint64_t event_ns = (now - start_ns) / events;
+        mgr->event_ns = mgr->event_ns - mgr->event_ns / 8 + event_ns / 8;
+    }
+
+    // while the batches come back full, the events left in the kernel wait since the loop last caught up. A rising
+    // lag is taken at once, so shedding starts before the queue builds up, and it comes down over the next batches
+    mgr->behind = behind;
+    uint64_t sample = now - mgr->behind_since;
+    uint64_t lag = mgr->stats.lag_ns;
+    if (events == 0) {
+        // the poll timed out, nothing was waiting
+        lag = 0;
+    } else {
+        lag = sample > lag ? sample : lag - lag / 8 + sample / 8;
+    }
+    __atomic_store_n(&mgr->stats.lag_ns, lag, __ATOMIC_RELAXED);
+
+    bool shedding = lag > (mgr->shedding ? mgr->lag_target_ns / 2 : mgr->lag_target_ns);
+    if (shedding == mgr->shedding) return false;
+
+    mgr->shedding = shedding;
+    if (shedding) {
+        sc_error_log(mgr, SC_LL_NORMAL, "[Sculpt] Loop lag at %llu us, shedding new clients\n",
+                     (unsigned long long) (lag / 1000));
+    } else {
+        sc_log(mgr, SC_LL_NORMAL, "[Sculpt] Loop lag back at %llu us, admitting new clients\n",
+               (unsigned long long) (lag / 1000));
+    }
+    return true;
+}
+
+bool _sc_overload_admit(sc_conn_mgr *mgr, int accepting) {
+    if (mgr->lag_target_ns == 0) return true;
+    if (mgr->shedding) return false;
+
+    // each client admitted since the loop caught up still has its request waiting, about one event each
+    uint64_t projected = mgr->stats.lag_ns + (uint64_t) (mgr->admitted + accepting + 1) * mgr->event_ns;
+    return projected <= mgr->lag_target_ns;
+}
+
+int _sc_overload_timeout(sc_conn_mgr *mgr, int timeout_ms) {
+    // while shedding, an idle loop still wakes up for its lag average to come down, within about the target
+    int wake_ms = (int) (mgr->lag_target_ns / 8 / 1000000) + 1;
+    if (mgr->shedding && (timeout_ms < 0 || timeout_ms > wake_ms)) {
+        return wake_ms;
+    }
+    return timeout_ms;
+}
@@ -0,0 +1,575 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#include "sculpt.h"
+
+void _sc_parser_reset(sc_conn *conn) {
+    struct _sc_parser *parser = &conn->parser;
+
+    parser->msg = (sc_http_msg) {0};
+    parser->header_count = 0;
+    parser->headers = NULL;
+    parser->headers_tail = NULL;
+    parser->state = SC_PARSE_REQUEST_LINE;
+    parser->pos = 0;
+    parser->scan = 0;
+    parser->keep_alive = false;
+    parser->http11 = false;
+    memset(parser->known, 0, sizeof(parser->known));
+    parser->unknown = NULL;
+    parser->expect_continue = false;
+    parser->body_state = SC_BODY_DATA;
+    parser->chunked = false;
+    parser->has_length = false;
+    parser->body_pos = 0;
+    parser->body_left = 0;
+    parser->body_read = 0;
+    parser->body_max = 0;
+    parser->route = NULL;
+}
+
+// finds the next complete line in the read buffer. The line is NUL-terminated in place (the \r\n is dropped).
+// if no line end was received yet, the scanned offset is saved so the next call doesn't search the same bytes again.
+static int next_line(sc_conn *conn, char **line, size_t *line_len) {
+    struct _sc_parser *parser = &conn->parser;
+    size_t start = parser->scan > parser->pos ? parser->scan : parser->pos;
+    size_t avail = conn->rbuf_len - start;
+
+    // the line ends at its first control byte, which has to be the \r\n (or a bare \n). Any other one, like a
+    // lone \r, is refused, as proxies may not agree on where such a line ends
+    size_t stop = start + _sc_scan(conn->rbuf + start, avail, '\n');
+    if (stop == conn->rbuf_len) {
+        parser->scan = conn->rbuf_len;
+        return SC_HEADER_PARSE_INCOMPLETE_ERR;
+    }
+
+    char *lf = conn->rbuf + stop;
+    if (*lf == '\r') {
+        if (stop + 1 == conn->rbuf_len) {
+            parser->scan = stop;
+            return SC_HEADER_PARSE_INCOMPLETE_ERR;
+        }
+        lf++;
+    }
+    if (*lf != '\n') {
+        return SC_MALFORMED_HEADER_ERR;
+    }
+
+    *line = conn->rbuf + parser->pos;
+    *line_len = stop - parser->pos;
+    (*line)[*line_len] = '\0';
+
+    parser->pos = lf - conn->rbuf + 1;
+    parser->scan = parser->pos;
+    return SC_OK;
+}
+
+// splits the request line in place. method and uri are NUL-terminated views into the line.
+int get_http_msg(char *header, size_t len, sc_http_msg *http_msg) {
+    if (http_msg == NULL) {
+        return SC_BAD_ARGUMENTS_ERR;
+    }
+    if (header == NULL) {
+        return SC_BAD_ARGUMENTS_ERR;
+    }
+    char *end = header + len;
+
+    // the line has no control bytes left, so the scan only stops at spaces (or the end of the line)
+    char *space = header + _sc_scan(header, len, ' ');
+    if (space == end) {
+        return SC_MALFORMED_HEADER_ERR;
+    }
+
+    // find method in header. Both are views into the read buffer, whose size is the only limit on the line
+    size_t method_len = space - header;
+    if (method_len == 0) {
+        return SC_MALFORMED_HEADER_ERR;
+    }
+
+    // skip extra spaces
+    char *uri_start = space + 1;
+    while (*uri_start == ' ') uri_start++;
+
+    // find uri in header
+    char *uri_end = uri_start + _sc_scan(uri_start, end - uri_start, ' ');
+    if (uri_end == end) {
+        return SC_MALFORMED_HEADER_ERR;
+    }
+
+    size_t uri_len = uri_end - uri_start;
+    if (uri_len == 0) {
+        return SC_MALFORMED_HEADER_ERR;
+    }
+
+    *space = '\0';
+    *uri_end = '\0';
+    http_msg->uri = sc_str_ref_n(uri_start, uri_len);
+    http_msg->method = sc_str_ref_n(header, method_len);
+
+    return SC_OK;
+}
+
+// names of the headers the parser files by sc_header_id, with the id as index
+static const sc_str known_headers[SC_HEADER_COUNT] = {
+    [SC_HEADER_HOST] = {"host", 4},
+    [SC_HEADER_CONNECTION] = {"connection", 10},
+    [SC_HEADER_CONTENT_LENGTH] = {"content-length", 14},
+    [SC_HEADER_CONTENT_TYPE] = {"content-type", 12},
+    [SC_HEADER_TRANSFER_ENCODING] = {"transfer-encoding", 17},
+    [SC_HEADER_EXPECT] = {"expect", 6},
+    [SC_HEADER_ACCEPT] = {"accept", 6},
+    [SC_HEADER_ACCEPT_ENCODING] = {"accept-encoding", 15},
+    [SC_HEADER_AUTHORIZATION] = {"authorization", 13},
+    [SC_HEADER_COOKIE] = {"cookie", 6},
+    [SC_HEADER_USER_AGENT] = {"user-agent", 10},
+    [SC_HEADER_ORIGIN] = {"origin", 6},
+    [SC_HEADER_REFERER] = {"referer", 7},
+    [SC_HEADER_IF_NONE_MATCH] = {"if-none-match", 13},
+    [SC_HEADER_IF_MODIFIED_SINCE] = {"if-modified-since", 17},
+    [SC_HEADER_RANGE] = {"range", 5},
+    [SC_HEADER_X_FORWARDED_FOR] = {"x-forwarded-for", 15},
+    [SC_HEADER_X_REQUEST_ID] = {"x-request-id", 12},
+};
+
+// returns the id of a known header name (case-insensitive), or -1
+static int header_classify(const char *name, size_t len) {
+    // the length rules out nearly every name before any byte is compared
+    for (int id = 0; id < SC_HEADER_COUNT; id++) {
+        if (known_headers[id].len == len && strncasecmp(name, known_headers[id].buf, len) == 0) {
+            return id;
+        }
+    }
+    return -1;
+}
+
+// FNV-1a over the lowercased name
+static unsigned int header_hash(const char *name, size_t len) {
+    unsigned int hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char) tolower((unsigned char) name[i])) * 16777619u;
+    }
+    return hash;
+}
+
+// files a header that isn't known in the hash table of the request, allocated in the arena with the first one
+static int header_index_unknown(sc_conn *conn, sc_str name, sc_str value) {
+    struct _sc_parser *parser = &conn->parser;
+
+    if (parser->unknown == NULL) {
+        parser->unknown = _sc_arena_alloc(&conn->arena, SC_HEADER_BUCKETS * sizeof(struct _sc_header_entry *));
+        if (parser->unknown == NULL) {
+            return SC_MALLOC_ERR;
+        }
+        memset(parser->unknown, 0, SC_HEADER_BUCKETS * sizeof(struct _sc_header_entry *));
+    }
+
+    struct _sc_header_entry *entry = _sc_arena_alloc(&conn->arena, sizeof(struct _sc_header_entry));
+    if (entry == NULL) {
+        return SC_MALLOC_ERR;
+    }
+    entry->hash = header_hash(name.buf, name.len);
+    entry->name = name;
+    entry->value = value;
+
+    // appended, so the first of repeated headers is found first, like for the known ones
+    struct _sc_header_entry **link = &parser->unknown[entry->hash % SC_HEADER_BUCKETS];
+    while (*link != NULL) {
+        link = &(*link)->next;
+    }
+    entry->next = NULL;
+    *link = entry;
+    return SC_OK;
+}
+
+// returns true if the comma separated list holds token (case-insensitive)
+static bool list_has_token(sc_str list, const char *token) {
+    size_t token_len = strlen(token);
+    size_t i = 0;
+
+    while (i < list.len) {
+        while (i < list.len && (list.buf[i] == ' ' || list.buf[i] == '\t' || list.buf[i] == ',')) i++;
+        size_t start = i;
+        while (i < list.len && list.buf[i] != ',') i++;
+        size_t end = i;
+        while (end > start && (list.buf[end - 1] == ' ' || list.buf[end - 1] == '\t')) end--;
+
+        if (end - start == token_len && strncasecmp(list.buf + start, token, token_len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// checks that the last coding of the Transfer-Encoding list is chunked, and no other one is (RFC 9112, section 6.1).
+// Each item has to match whole, so a coding like "xchunked" can't pass for it. A list that doesn't end with chunked
+// is a coding the server doesn't know, unless chunked came before it, which is malformed
+static int coding_list_check(sc_str list) {
+    size_t i = 0;
+    bool last_chunked = false;
+
+    while (i <= list.len) {
+        size_t start = i;
+        while (i < list.len && list.buf[i] != ',') i++;
+        size_t end = i++;
+
+        while (start < end && (list.buf[start] == ' ' || list.buf[start] == '\t')) start++;
+        while (end > start && (list.buf[end - 1] == ' ' || list.buf[end - 1] == '\t')) end--;
+        if (start == end || last_chunked) {
+            return SC_MALFORMED_HEADER_ERR;
+        }
+        last_chunked = end - start == 7 && strncasecmp(list.buf + start, "chunked", 7) == 0;
+    }
+    return last_chunked ? SC_OK : SC_NOT_IMPLEMENTED_ERR;
+}
+
+// reads the headers that frame the body: Content-Length, Transfer-Encoding and Expect
+static int body_header_parse(struct _sc_parser *parser, int id, sc_str value) {
+    if (id == SC_HEADER_CONTENT_LENGTH) {
+        if (value.len == 0) {
+            return SC_MALFORMED_HEADER_ERR;
+        }
+
+        size_t length = 0;
+        for (size_t i = 0; i < value.len; i++) {
+            if (!isdigit((unsigned char) value.buf[i])) {
+                return SC_MALFORMED_HEADER_ERR;
+            }
+            if (length > (SIZE_MAX - 9) / 10) {
+                return SC_BODY_TOO_LARGE_ERR;
+            }
+            length = length * 10 + (value.buf[i] - '0');
+        }
+
+        // a second, different length can't be trusted (RFC 9112, section 6.3)
+        if (parser->has_length && parser->body_left != length) {
+            return SC_MALFORMED_HEADER_ERR;
+        }
+        parser->has_length = true;
+        parser->body_left = length;
+    } else if (id == SC_HEADER_TRANSFER_ENCODING) {
+        // only chunked framing is understood. A later header line would add codings after it
+        if (parser->chunked) {
+            return SC_MALFORMED_HEADER_ERR;
+        }
+        int err = coding_list_check(value);
+        if (err != SC_OK) {
+            return err;
+        }
+        parser->chunked = true;
+    } else if (id == SC_HEADER_EXPECT) {
+        parser->expect_continue = value.len == 12 && strncasecmp(value.buf, "100-continue", 12) == 0;
+    }
+    return SC_OK;
+}
+
+// splits a header line into its name and value, and files it by name
+static int header_index(sc_conn *conn, char *line, size_t line_len) {
+    struct _sc_parser *parser = &conn->parser;
+
+    char *colon = line + _sc_scan(line, line_len, ':');
+    if (colon == line + line_len || colon == line) {
+        return SC_MALFORMED_HEADER_ERR;
+    }
+    // no whitespace is allowed between the name and the colon (RFC 9112, section 5.1)
+    if (colon[-1] == ' ' || colon[-1] == '\t') {
+        return SC_MALFORMED_HEADER_ERR;
+    }
+
+    sc_str name = sc_str_ref_n(line, colon - line);
+    char *value_start = colon + 1;
+    char *value_end = line + line_len;
+    while (value_start < value_end && (*value_start == ' ' || *value_start == '\t')) value_start++;
+    while (value_end > value_start && (value_end[-1] == ' ' || value_end[-1] == '\t')) value_end--;
+    sc_str value = sc_str_ref_n(value_start, value_end - value_start);
+
+    int id = header_classify(name.buf, name.len);
+    if (id < 0) {
+        return header_index_unknown(conn, name, value);
+    }
+
+    // repeated headers keep their first value
+    if (parser->known[id].buf == NULL) {
+        parser->known[id] = value;
+    }
+    return body_header_parse(parser, id, value);
+}
+
+// called once the empty line after the headers was parsed, to find out if a body follows
+static int body_start(struct _sc_parser *parser, size_t max_body) {
+    parser->body_pos = parser->pos;
+    parser->body_max = max_body;
+
+    // HTTP/1.1 connections are persistent unless the client says otherwise, HTTP/1.0 ones the other way around
+    sc_str connection = parser->known[SC_HEADER_CONNECTION];
+    if (parser->http11) {
+        parser->keep_alive = !list_has_token(connection, "close");
+    } else {
+        parser->keep_alive = list_has_token(connection, "keep-alive");
+    }
+
+    // both at once is how requests are smuggled past proxies, so it is refused (RFC 9112, section 6.1)
+    if (parser->chunked && parser->has_length) {
+        return SC_MALFORMED_HEADER_ERR;
+    }
+
+    if (parser->chunked) {
+        parser->body_state = SC_BODY_CHUNK_SIZE;
+        parser->state = SC_PARSE_BODY;
+    } else if (parser->body_left > 0) {
+        if (parser->body_left > max_body) {
+            return SC_BODY_TOO_LARGE_ERR;
+        }
+        parser->body_state = SC_BODY_DATA;
+        parser->state = SC_PARSE_BODY;
+        parser->body_read = parser->body_left;
+    } else {
+        parser->state = SC_PARSE_DONE;
+    }
+    return SC_OK;
+}
+
+int _sc_request_parse(sc_conn *conn, size_t max_body) {
+    struct _sc_parser *parser = &conn->parser;
+    char *line;
+    size_t line_len;
+    int err;
+
+    while (parser->state == SC_PARSE_REQUEST_LINE || parser->state == SC_PARSE_HEADERS) {
+        err = next_line(conn, &line, &line_len);
+        if (err == SC_HEADER_PARSE_INCOMPLETE_ERR) {
+            // the whole request head has to fit in the buffer, as the request always starts at its beginning
+            if (conn->rbuf_len >= conn->rbuf_cap) {
+                return SC_HEADER_TOO_LARGE_ERR;
+            }
+            return err;
+        }
+        if (err != SC_OK) {
+            return err;
+        }
+
+        if (parser->state == SC_PARSE_REQUEST_LINE) {
+            // empty lines before the request line are ignored (RFC 9112, section 2.2)
+            if (line_len == 0) continue;
+
+            err = get_http_msg(line, line_len, &parser->msg);
+            if (err != SC_OK) {
+                return err;
+            }
+
+            // the version follows the uri, HTTP/1.1 and later 1.x versions share the same connection handling
+            const char *version = parser->msg.uri.buf + parser->msg.uri.len + 1;
+            while (*version == ' ') version++;
+            parser->http11 = strncmp(version, "HTTP/1.", 7) == 0 && version[7] >= '1' && version[7] <= '9';
+
+            parser->state = SC_PARSE_HEADERS;
+            continue;
+        }
+
+        // an empty line marks the end of the headers
+        if (line_len == 0) {
+            return body_start(parser, max_body);
+        }
+
+        if (parser->header_count >= SC_MAX_REQUEST_HEADERS) {
+            return SC_HEADER_TOO_LARGE_ERR;
+        }
+
+        err = header_index(conn, line, line_len);
+        if (err != SC_OK) {
+            return err;
+        }
+
+        // the header list nodes come from the request arena, and point at the line in the read buffer
+        sc_headers *node = _sc_arena_alloc(&conn->arena, sizeof(sc_headers));
+        if (node == NULL) {
+            return SC_MALLOC_ERR;
+        }
+        node->header = sc_str_ref_n(line, line_len);
+        node->ref = true;
+        node->next = NULL;
+        if (parser->headers_tail != NULL) {
+            parser->headers_tail->next = node;
+        } else {
+            parser->headers = node;
+        }
+        parser->headers_tail = node;
+        parser->header_count++;
+    }
+
+    return SC_OK;
+}
+
+sc_headers *_sc_request_headers(sc_conn *conn) {
+    return conn->parser.headers;
+}
+
+// drops the body bytes that were already handed out, so the rest of the buffer after the head is free again
+static int body_wait(sc_conn *conn) {
+    struct _sc_parser *parser = &conn->parser;
+
+    if (parser->body_pos > parser->pos) {
+        memmove(conn->rbuf + parser->pos, conn->rbuf + parser->body_pos, conn->rbuf_len - parser->body_pos);
+        conn->rbuf_len -= parser->body_pos - parser->pos;
+        parser->body_pos = parser->pos;
+    }
+
+    // a chunk size or trailer line that doesn't fit next to the head
+    if (conn->rbuf_len >= conn->rbuf_cap) {
+        return SC_BUFFER_OVERFLOW_ERR;
+    }
+    return SC_HEADER_PARSE_INCOMPLETE_ERR;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// parses the size line of a chunk. Chunk extensions (after ';') are ignored
+static int chunk_size_parse(struct _sc_parser *parser, const char *line, size_t line_len) {
+    size_t size = 0;
+    size_t i = 0;
+
+    for (; i < line_len && hex_value(line[i]) >= 0; i++) {
+        if (size > (SIZE_MAX >> 4)) {
+            return SC_BODY_TOO_LARGE_ERR;
+        }
+        size = (size << 4) | hex_value(line[i]);
+    }
+    if (i == 0 || (i < line_len && line[i] != ';' && line[i] != ' ' && line[i] != '\t')) {
+        return SC_MALFORMED_BODY_ERR;
+    }
+
+    if (size > parser->body_max - parser->body_read) {
+        return SC_BODY_TOO_LARGE_ERR;
+    }
+    parser->body_read += size;
+
+    if (size == 0) {
+        parser->body_state = SC_BODY_TRAILERS;
+    } else {
+        parser->body_left = size;
+        parser->body_state = SC_BODY_DATA;
+    }
+    return SC_OK;
+}
+
+int _sc_body_next(sc_conn *conn, sc_str *chunk) {
+    struct _sc_parser *parser = &conn->parser;
+
+    while (parser->state == SC_PARSE_BODY) {
+        char *start = conn->rbuf + parser->body_pos;
+        size_t avail = conn->rbuf_len - parser->body_pos;
+
+        if (parser->body_state == SC_BODY_DATA) {
+            if (parser->body_left == 0) {
+                if (parser->chunked) {
+                    parser->body_state = SC_BODY_CHUNK_END;
+                } else {
+                    parser->state = SC_PARSE_DONE;
+                }
+                continue;
+            }
+            if (avail == 0) {
+                return body_wait(conn);
+            }
+
+            // everything received of the body is handed out at once, straight from the read buffer
+            size_t len = avail < parser->body_left ? avail : parser->body_left;
+            *chunk = sc_str_ref_n(start, len);
+            parser->body_pos += len;
+            parser->body_left -= len;
+            return SC_OK;
+        }
+
+        // the rest of the chunked framing is line based: chunk sizes, the \r\n after each chunk and the trailers
+        char *lf = memchr(start, '\n', avail);
+        if (lf == NULL) {
+            return body_wait(conn);
+        }
+        size_t line_len = lf - start;
+        if (line_len > 0 && start[line_len - 1] == '\r') {
+            line_len--;
+        }
+        parser->body_pos = lf - conn->rbuf + 1;
+
+        int err = SC_OK;
+        switch (parser->body_state) {
+            case SC_BODY_CHUNK_SIZE:
+                err = chunk_size_parse(parser, start, line_len);
+                break;
+            case SC_BODY_CHUNK_END:
+                if (line_len != 0) {
+                    err = SC_MALFORMED_BODY_ERR;
+                }
+                parser->body_state = SC_BODY_CHUNK_SIZE;
+                break;
+            case SC_BODY_TRAILERS:
+                // trailer fields are ignored, an empty line ends the body
+                if (line_len == 0) {
+                    parser->state = SC_PARSE_DONE;
+                }
+                break;
+            default:
+                break;
+        }
+        if (err != SC_OK) {
+            return err;
+        }
+    }
+
+    return SC_FINISHED;
+}
+
+void _sc_request_consume(sc_conn *conn) {
+    // the body (if any) was read up to body_pos
+    size_t used = conn->parser.body_pos;
+
+    // keep whatever was received after this request at the start of the buffer
+    if (used < conn->rbuf_len) {
+        memmove(conn->rbuf, conn->rbuf + used, conn->rbuf_len - used);
+        conn->rbuf_len -= used;
+    } else {
+        conn->rbuf_len = 0;
+    }
+
+    _sc_parser_reset(conn);
+}
+
+sc_str sc_req_header_get(int fd, sc_header_id id) {
+    sc_conn *conn = _sc_conn_current(fd);
+    if (conn == NULL || id < 0 || id >= SC_HEADER_COUNT) {
+        return sc_str_ref_n(NULL, 0);
+    }
+    return conn->parser.known[id];
+}
+
+sc_str sc_req_header_find(int fd, const char *name) {
+    sc_conn *conn = _sc_conn_current(fd);
+    if (conn == NULL || name == NULL) {
+        return sc_str_ref_n(NULL, 0);
+    }
+
+    size_t len = strlen(name);
+    int id = header_classify(name, len);
+    if (id >= 0) {
+        return conn->parser.known[id];
+    }
+    if (conn->parser.unknown == NULL) {
+        return sc_str_ref_n(NULL, 0);
+    }
+
+    unsigned int hash = header_hash(name, len);
+    for (struct _sc_header_entry *entry = conn->parser.unknown[hash % SC_HEADER_BUCKETS]; entry != NULL; entry = entry->next) {
+        if (entry->hash == hash && entry->name.len == len && strncasecmp(entry->name.buf, name, len) == 0) {
+            return entry->value;
+        }
+    }
+    return sc_str_ref_n(NULL, 0);
+}
@@ -0,0 +1,165 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "sculpt.h"
+
+static struct _route_node *create_node(sc_str label) {
+    struct _route_node *node = calloc(1, sizeof(struct _route_node));
+    if (node == NULL) {
+        return NULL;
+    }
+    node->label = label;
+    return node;
+}
+
+// children are few per node and kept sorted by their first byte, which is stored apart for a tight scan
+static int find_child(const struct _route_node *node, unsigned char key) {
+    for (int i = 0; i < node->child_count; i++) {
+        if (node->child_keys[i] == key) return i;
+        if (node->child_keys[i] > key) break;
+    }
+    return -1;
+}
+
+static int add_child(struct _route_node *node, struct _route_node *child) {
+    if (node->child_count == node->child_cap) {
+        int cap = node->child_cap ? node->child_cap * 2 : 2;
+        struct _route_node **children = realloc(node->children, cap * sizeof(struct _route_node *));
+        if (children == NULL) {
+            return SC_MALLOC_ERR;
+        }
+        node->children = children;
+
+        unsigned char *keys = realloc(node->child_keys, cap);
+        if (keys == NULL) {
+            return SC_MALLOC_ERR;
+        }
+        node->child_keys = keys;
+        node->child_cap = cap;
+    }
+
+    unsigned char key = child->label.buf[0];
+    int i = node->child_count;
+    while (i > 0 && node->child_keys[i - 1] > key) {
+        node->children[i] = node->children[i - 1];
+        node->child_keys[i] = node->child_keys[i - 1];
+        i--;
+    }
+    node->children[i] = child;
+    node->child_keys[i] = key;
+    node->child_count++;
+    return SC_OK;
+}
+
+// splits the child at index i so its label ends after len bytes, and returns the new middle node
+static struct _route_node *split_child(struct _route_node *node, int i, size_t len) {
+    struct _route_node *child = node->children[i];
+    struct _route_node *mid = create_node(sc_str_ref_n(child->label.buf, len));
+    if (mid == NULL) {
+        return NULL;
+    }
+
+    child->label = sc_str_ref_n(child->label.buf + len, child->label.len - len);
+    if (add_child(mid, child) != SC_OK) {
+        child->label = sc_str_ref_n(child->label.buf - len, child->label.len + len);
+        free(mid);
+        return NULL;
+    }
+
+    // the first byte is unchanged, so the key and the order of the parent stay valid
+    node->children[i] = mid;
+    return mid;
+}
+
+int _sc_route_insert(struct _route_node **root, struct _endpoint_list *endpoint) {
+    if (*root == NULL) {
+        *root = create_node(sc_str_ref_n("", 0));
+        if (*root == NULL) {
+            return SC_MALLOC_ERR;
+        }
+    }
+
+    struct _route_node *node = *root;
+    sc_str path = endpoint->val;
+    size_t pos = 0;
+
+    while (pos < path.len) {
+        int i = find_child(node, path.buf[pos]);
+        if (i < 0) {
+            struct _route_node *leaf = create_node(sc_str_ref_n(path.buf + pos, path.len - pos));
+            if (leaf == NULL || add_child(node, leaf) != SC_OK) {
+                free(leaf);
+                return SC_MALLOC_ERR;
+            }
+            node = leaf;
+            pos = path.len;
+            break;
+        }
+
+        struct _route_node *child = node->children[i];
+        size_t common = 0;
+        while (common < child->label.len && pos + common < path.len
+               && child->label.buf[common] == path.buf[pos + common]) {
+            common++;
+        }
+
+        if (common < child->label.len) {
+            child = split_child(node, i, common);
+            if (child == NULL) {
+                return SC_MALLOC_ERR;
+            }
+        }
+        node = child;
+        pos += common;
+    }
+
+    // binding the same path twice replaces the previous endpoint
+    if (endpoint->soft) {
+        node->soft = endpoint;
+    } else {
+        node->hard = endpoint;
+    }
+    return SC_OK;
+}
+
+struct _endpoint_list *_sc_route_find(const struct _route_node *root, sc_str uri) {
+    if (root == NULL) return NULL;
+
+    const struct _route_node *node = root;
+    struct _endpoint_list *best = root->soft;
+    size_t pos = 0;
+
+    while (pos < uri.len) {
+        int i = find_child(node, uri.buf[pos]);
+        if (i < 0) break;
+
+        const struct _route_node *child = node->children[i];
+        if (uri.len - pos < child->label.len || memcmp(uri.buf + pos, child->label.buf, child->label.len) != 0) {
+            break;
+        }
+
+        node = child;
+        pos += child->label.len;
+        if (node->soft) {
+            // the longest soft prefix seen so far
+            best = node->soft;
+        }
+    }
+
+    // an exact hard bind wins over any soft prefix
+    if (pos == uri.len && node->hard) {
+        return node->hard;
+    }
+    return best;
+}
+
+void _sc_route_free(struct _route_node *node) {
+    if (node == NULL) return;
+
+    for (int i = 0; i < node->child_count; i++) {
+        _sc_route_free(node->children[i]);
+    }
+    free(node->children);
+    free(node->child_keys);
+    free(node);
+}
@@ -0,0 +1,89 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SC_SCAN_X86 1
+#endif
+
+#include "sculpt.h"
+
+// control bytes end a line or make it invalid. Tab is allowed, as it is whitespace in header values
+static inline bool is_stop(unsigned char c, unsigned char delim) {
+    return c == delim || (c < 0x20 && c != '\t') || c == 0x7f;
+}
+
+static size_t scan_scalar(const char *buf, size_t len, char delim) {
+    for (size_t i = 0; i < len; i++) {
+        if (is_stop((unsigned char) buf[i], (unsigned char) delim)) return i;
+    }
+    return len;
+}
+
+#ifdef SC_SCAN_X86
+
+// compares 16 bytes at a time against the ranges of the control bytes and the delimiter, in one instruction
+__attribute__((target("sse4.2")))
+static size_t scan_sse42(const char *buf, size_t len, char delim) {
+    const __m128i ranges = _mm_setr_epi8(0x00, 0x08, 0x0a, 0x1f, 0x7f, 0x7f, delim, delim,
+                                         0, 0, 0, 0, 0, 0, 0, 0);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i data = _mm_loadu_si128((const __m128i *) (buf + i));
+        int idx = _mm_cmpestri(ranges, 8, data, 16, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (idx < 16) return i + idx;
+    }
+    return i + scan_scalar(buf + i, len - i, delim);
+}
+
+// builds a mask of the stop bytes of 32 bytes at a time with plain compares
+__attribute__((target("avx2")))
+static size_t scan_avx2(const char *buf, size_t len, char delim) {
+    const __m256i ctl_max = _mm256_set1_epi8(0x1f);
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    const __m256i dlm = _mm256_set1_epi8(delim);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i data = _mm256_loadu_si256((const __m256i *) (buf + i));
+
+        // unsigned data <= 0x1f, as min(data, 0x1f) == data
+        __m256i stop = _mm256_cmpeq_epi8(_mm256_min_epu8(data, ctl_max), data);
+        stop = _mm256_andnot_si256(_mm256_cmpeq_epi8(data, tab), stop);
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(data, del));
+        stop = _mm256_or_si256(stop, _mm256_cmpeq_epi8(data, dlm));
+
+        unsigned int mask = (unsigned int) _mm256_movemask_epi8(stop);
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+    return i + scan_scalar(buf + i, len - i, delim);
+}
+
+#endif
+
+static size_t scan_resolve(const char *buf, size_t len, char delim);
+
+static size_t (*scan_impl)(const char *, size_t, char) = scan_resolve;
+
+// picks the widest implementation the CPU supports on the first call
+static size_t scan_resolve(const char *buf, size_t len, char delim) {
+    size_t (*impl)(const char *, size_t, char) = scan_scalar;
+
+#ifdef SC_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        impl = scan_avx2;
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        impl = scan_sse42;
+    }
+#endif
+
+    __atomic_store_n(&scan_impl, impl, __ATOMIC_RELAXED);
+    return impl(buf, len, delim);
+}
+
+size_t _sc_scan(const char *buf, size_t len, char delim) {
+    return __atomic_load_n(&scan_impl, __ATOMIC_RELAXED)(buf, len, delim);
+}
@@ -0,0 +1,356 @@
+#include "sculpt.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <limits.h>
+#include <ctype.h>
+
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+
+/* open file kept in the cache of one loop, shared by every connection sending it */
+struct _sc_file {
+    char *path;
+    int fd;
+    off_t size;
+    time_t mtime;
+    ino_t ino;
+    const char *mime;
+    time_t checked;             // when the entry was last compared with the file on disk
+    int refs;                   // connections still sending from fd, plus one while it is cached
+    struct _sc_file *next;      // hash chain
+};
+
+struct _sc_file_cache {
+    struct _sc_file *buckets[SC_FILE_CACHE_BUCKETS];
+    int count;
+    int evict_cursor;
+};
+
+static const struct {
+    const char *ext;
+    const char *mime;
+} mime_types[] = {
+    {"html", "text/html; charset=UTF-8"},
+    {"htm", "text/html; charset=UTF-8"},
+    {"css", "text/css; charset=UTF-8"},
+    {"js", "text/javascript; charset=UTF-8"},
+    {"mjs", "text/javascript; charset=UTF-8"},
+    {"json", "application/json"},
+    {"txt", "text/plain; charset=UTF-8"},
+    {"xml", "application/xml"},
+    {"svg", "image/svg+xml"},
+    {"png", "image/png"},
+    {"jpg", "image/jpeg"},
+    {"jpeg", "image/jpeg"},
+    {"gif", "image/gif"},
+    {"webp", "image/webp"},
+    {"ico", "image/x-icon"},
+    {"woff", "font/woff"},
+    {"woff2", "font/woff2"},
+    {"wasm", "application/wasm"},
+    {"pdf", "application/pdf"},
+    {"mp4", "video/mp4"},
+};
+
+static const char *mime_type(const char *path) {
+    const char *dot = strrchr(path, '.');
+    if (dot == NULL || strchr(dot, '/') != NULL) {
+        return "application/octet-stream";
+    }
+
+    for (size_t i = 0; i < sizeof(mime_types) / sizeof(mime_types[0]); i++) {
+        if (strcasecmp(dot + 1, mime_types[i].ext) == 0) {
+            return mime_types[i].mime;
+        }
+    }
+    return "application/octet-stream";
+}
+
+static unsigned int path_hash(const char *path) {
+    // FNV-1a
+    unsigned int hash = 2166136261u;
+    for (; *path; path++) {
+        hash = (hash ^ (unsigned char) *path) * 16777619u;
+    }
+    return hash;
+}
+
+void _sc_file_put(struct _sc_file *file) {
+    if (file == NULL || --file->refs > 0) return;
+
+    close(file->fd);
+    free(file->path);
+    free(file);
+}
+
+static void cache_remove(struct _sc_file_cache *cache, struct _sc_file **link) {
+    struct _sc_file *file = *link;
+    *link = file->next;
+    cache->count--;
+
+    // connections still sending it keep the fd open until they are done
+    _sc_file_put(file);
+}
+
+// drops one entry that no connection is sending, so the cache doesn't hold more than SC_FILE_CACHE_MAX fds
+static void cache_evict(struct _sc_file_cache *cache) {
+    for (int i = 0; i < SC_FILE_CACHE_BUCKETS; i++) {
+        int bucket = (cache->evict_cursor + i) % SC_FILE_CACHE_BUCKETS;
+        for (struct _sc_file **link = &cache->buckets[bucket]; *link != NULL; link = &(*link)->next) {
+            if ((*link)->refs == 1) {
+                cache_remove(cache, link);
+                cache->evict_cursor = bucket + 1;
+                return;
+            }
+        }
+    }
+}
+
+static struct _sc_file *file_open(const char *path, time_t now) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return NULL;
+    }
+
+    struct _sc_file *file = malloc(sizeof(struct _sc_file));
+    char *path_copy = strdup(path);
+    if (file == NULL || path_copy == NULL) {
+        free(file);
+        free(path_copy);
+        close(fd);
+        return NULL;
+    }
+
+    file->path = path_copy;
+    file->fd = fd;
+    file->size = st.st_size;
+    file->mtime = st.st_mtime;
+    file->ino = st.st_ino;
+    file->mime = mime_type(path);
+    file->checked = now;
+    file->refs = 1;
+    file->next = NULL;
+    return file;
+}
+
+struct _sc_file *_sc_file_cache_get(sc_conn_mgr *mgr, const char *path) {
+    if (mgr->files == NULL) {
+        mgr->files = calloc(1, sizeof(struct _sc_file_cache));
+        if (mgr->files == NULL) {
+            return NULL;
+        }
+    }
+    struct _sc_file_cache *cache = mgr->files;
+    unsigned int bucket = path_hash(path) % SC_FILE_CACHE_BUCKETS;
+
+    for (struct _sc_file **link = &cache->buckets[bucket]; *link != NULL; link = &(*link)->next) {
+        struct _sc_file *file = *link;
+        if (strcmp(file->path, path) != 0) continue;
+
+        if (mgr->now - file->checked < SC_FILE_CACHE_TTL) {
+            return file;
+        }
+
+        // the TTL expired, so the entry is kept only if the file on disk is still the same
+        struct stat st;
+        if (stat(path, &st) == 0 && st.st_ino == file->ino && st.st_mtime == file->mtime && st.st_size == file->size) {
+            file->checked = mgr->now;
+            return file;
+        }
+        cache_remove(cache, link);
+        break;
+    }
+
+    struct _sc_file *file = file_open(path, mgr->now);
+    if (file == NULL) {
+        return NULL;
+    }
+
+    if (cache->count >= SC_FILE_CACHE_MAX) {
+        cache_evict(cache);
+    }
+    file->next = cache->buckets[bucket];
+    cache->buckets[bucket] = file;
+    cache->count++;
+    return file;
+}
+
+void _sc_file_cache_destroy(sc_conn_mgr *mgr) {
+    struct _sc_file_cache *cache = mgr->files;
+    if (cache == NULL) return;
+
+    for (int i = 0; i < SC_FILE_CACHE_BUCKETS; i++) {
+        while (cache->buckets[i] != NULL) {
+            cache_remove(cache, &cache->buckets[i]);
+        }
+    }
+    free(cache);
+    mgr->files = NULL;
+}
+
+int _sc_file_send(sc_conn *conn) {
+    struct _sc_file *file = conn->file;
+
+    while (conn->file_off < conn->file_end) {
+        size_t chunk = conn->file_end - conn->file_off;
+        if (chunk > SC_SENDFILE_CHUNK) {
+            chunk = SC_SENDFILE_CHUNK;
+        }
+
+        ssize_t n = sendfile(conn->fd, file->fd, &conn->file_off, chunk);
+        if (n > 0) continue;
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return SC_PENDING;
+        }
+        // n == 0 means the file was truncated after the headers were sent, the response can't be completed
+        return SC_SEND_ERR;
+    }
+
+    _sc_file_put(file);
+    conn->file = NULL;
+    return SC_OK;
+}
+
+static int hex_digit(char c) {
+    return isdigit((unsigned char) c) ? c - '0' : tolower((unsigned char) c) - 'a' + 10;
+}
+
+// decodes %XX escapes into dst. Returns false if the path can't be served: malformed escapes, NUL bytes, or ".."
+// segments
+static bool path_decode(char *dst, size_t dst_size, const char *src, size_t len) {
+    size_t out = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        char c = src[i];
+        if (c == '?' || c == '#') break;
+
+        if (c == '%') {
+            if (i + 2 >= len || !isxdigit((unsigned char) src[i + 1]) || !isxdigit((unsigned char) src[i + 2])) {
+                return false;
+            }
+            c = (char) (hex_digit(src[i + 1]) << 4 | hex_digit(src[i + 2]));
+            if (c == '\0') return false;
+            i += 2;
+        }
+
+        if (out + 1 >= dst_size) return false;
+        dst[out++] = c;
+    }
+    dst[out] = '\0';
+
+    // reject anything that could escape the directory
+    for (const char *seg = dst; seg != NULL; seg = strchr(seg, '/')) {
+        if (*seg == '/') seg++;
+        if (seg[0] == '.' && seg[1] == '.' && (seg[2] == '/' || seg[2] == '\0')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// files can only be read, the client is told which methods it can use instead
+static int method_not_allowed(sc_conn *conn) {
+    char response[SC_EASY_HEAD_SIZE];
+    int len = snprintf(response, sizeof(response),
+                       "HTTP/1.1 405 Method Not Allowed\r\n"
+                       "Allow: GET, HEAD\r\n"
+                       "Content-Length: 0\r\n"
+                       "Connection: %s\r\n"
+                       "\r\n",
+                       _sc_conn_keep_alive(conn) ? "keep-alive" : "close");
+
+    int rc = _sc_conn_write(conn, response, len);
+    if (rc == SC_OK) {
+        conn->access.status = 405;
+    }
+    return rc;
+}
+
+int _sc_static_serve(sc_conn_mgr *mgr, sc_conn *conn, struct _endpoint_list *endpoint) {
+    sc_http_msg msg = conn->parser.msg;
+    bool head = sc_strcmp(msg.method, sc_str_ref("HEAD")) == 0;
+    if (!head && sc_strcmp(msg.method, sc_str_ref("GET")) != 0) {
+        return method_not_allowed(conn);
+    }
+
+    char rel[PATH_MAX];
+    if (!path_decode(rel, sizeof(rel), msg.uri.buf + endpoint->val.len, msg.uri.len - endpoint->val.len)) {
+        return SC_BAD_ARGUMENTS_ERR;
+    }
+
+    char path[PATH_MAX];
+    size_t rel_len = strlen(rel);
+    bool index = rel_len == 0 || rel[rel_len - 1] == '/';
+    int len = snprintf(path, sizeof(path), "%s%s%s%s", endpoint->dir, rel[0] == '/' ? "" : "/", rel, index ? "index.html" : "");
+    if (len < 0 || (size_t) len >= sizeof(path)) {
+        return SC_BUFFER_OVERFLOW_ERR;
+    }
+
+    struct _sc_file *file = _sc_file_cache_get(mgr, path);
+    if (file == NULL) {
+        sc_log(mgr, SC_LL_DEBUG, "[Sculpt] Static file not found: %s\n", path);
+        return SC_FINISHED;
+    }
+
+    char head_buf[SC_EASY_HEAD_SIZE];
+    len = snprintf(head_buf, sizeof(head_buf),
+                   "HTTP/1.1 200 OK\r\n"
+                   "Content-Type: %s\r\n"
+                   "Content-Length: %lld\r\n"
+                   "Connection: %s\r\n"
+                   "\r\n",
+                   file->mime, (long long) file->size, _sc_conn_keep_alive(conn) ? "keep-alive" : "close");
+    if (len < 0 || (size_t) len >= sizeof(head_buf)) {
+        return SC_BUFFER_OVERFLOW_ERR;
+    }
+
+    int rc = _sc_conn_write(conn, head_buf, len);
+    if (rc != SC_OK) {
+        return rc;
+    }
+    conn->access.status = 200;
+
+    // the body is sent from the file by the flush, right after the queued headers
+    if (!head && file->size > 0) {
+        file->refs++;
+        conn->file = file;
+        conn->file_off = 0;
+        conn->file_end = file->size;
+        conn->out_bytes += file->size;
+    }
+    return SC_OK;
+}
+
+int sc_mgr_bind_static_dir(sc_conn_mgr *mgr, const char *endpoint, const char *dir) {
+    if (mgr == NULL || endpoint == NULL || dir == NULL) return SC_BAD_ARGUMENTS_ERR;
+
+    char *dir_copy = strdup(dir);
+    if (dir_copy == NULL) {
+        return SC_MALLOC_ERR;
+    }
+
+    // trailing slashes are dropped, the request path brings its own
+    size_t len = strlen(dir_copy);
+    while (len > 1 && dir_copy[len - 1] == '/') {
+        dir_copy[--len] = '\0';
+    }
+
+    int rc = _sc_mgr_bind(mgr, endpoint, true, NULL);
+    if (rc != SC_OK) {
+        free(dir_copy);
+        return rc;
+    }
+    mgr->endpoints->dir = dir_copy;
+    return SC_OK;
+}
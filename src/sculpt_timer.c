@@ -0,0 +1,117 @@
+#include <stdlib.h>
+#include <time.h>
+
+#include "sculpt.h"
+
+#define SLOT_MASK (SC_TIMER_WHEEL_SLOTS - 1)
+
+time_t _sc_clock_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec;
+}
+
+uint64_t _sc_clock_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void list_init(struct _sc_timer *head) {
+    head->prev = head;
+    head->next = head;
+}
+
+static void list_insert(struct _sc_timer *head, struct _sc_timer *timer) {
+    timer->next = head->next;
+    timer->prev = head;
+    head->next->prev = timer;
+    head->next = timer;
+}
+
+void _sc_timer_wheel_init(struct _sc_timer_wheel *wheel, time_t now) {
+    for (int level = 0; level < SC_TIMER_WHEEL_LEVELS; level++) {
+        for (int slot = 0; slot < SC_TIMER_WHEEL_SLOTS; slot++) {
+            list_init(&wheel->slots[level][slot]);
+        }
+    }
+    wheel->current = now;
+}
+
+void _sc_timer_add(struct _sc_timer_wheel *wheel, struct _sc_timer *timer, time_t deadline) {
+    _sc_timer_del(timer);
+
+    // timers that are already due fire on the next tick
+    if (deadline <= wheel->current) {
+        deadline = wheel->current + 1;
+    }
+    timer->deadline = deadline;
+
+    // the level is picked from the distance to the deadline, the slot from the deadline itself,
+    // so timers of an upper level slot all move down together when the lower level wraps around
+    time_t delta = deadline - wheel->current;
+    int level = 0;
+    while (level < SC_TIMER_WHEEL_LEVELS - 1 && delta >= ((time_t) 1 << (SC_TIMER_WHEEL_BITS * (level + 1)))) {
+        level++;
+    }
+    int slot = (deadline >> (SC_TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+
+    list_insert(&wheel->slots[level][slot], timer);
+}
+
+void _sc_timer_del(struct _sc_timer *timer) {
+    if (timer->next == NULL) return;
+
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+// moves the timers of an upper level slot to the levels below
+static void cascade(struct _sc_timer_wheel *wheel, int level) {
+    int slot = (wheel->current >> (SC_TIMER_WHEEL_BITS * level)) & SLOT_MASK;
+    struct _sc_timer *head = &wheel->slots[level][slot];
+
+    while (head->next != head) {
+        struct _sc_timer *timer = head->next;
+        _sc_timer_add(wheel, timer, timer->deadline);
+    }
+
+    if (slot == 0 && level < SC_TIMER_WHEEL_LEVELS - 1) {
+        cascade(wheel, level + 1);
+    }
+}
+
+int _sc_timer_wheel_advance(struct _sc_timer_wheel *wheel, time_t now, void (*expire)(struct _sc_timer *, void *), void *ctx) {
+    int expired = 0;
+
+    while (wheel->current < now) {
+        wheel->current++;
+
+        int slot = wheel->current & SLOT_MASK;
+        if (slot == 0) {
+            cascade(wheel, 1);
+        }
+
+        // detach the whole slot first, as the callback may add the timer again
+        struct _sc_timer due;
+        struct _sc_timer *head = &wheel->slots[0][slot];
+        if (head->next == head) continue;
+
+        due.next = head->next;
+        due.prev = head->prev;
+        due.next->prev = &due;
+        due.prev->next = &due;
+        list_init(head);
+
+        while (due.next != &due) {
+            struct _sc_timer *timer = due.next;
+            _sc_timer_del(timer);
+            expire(timer, ctx);
+            expired++;
+        }
+    }
+
+    return expired;
+}
@@ -0,0 +1,792 @@
+#include "sculpt.h"
+
+#ifdef SC_IO_URING
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+_Static_assert((SC_URING_BUFFERS & (SC_URING_BUFFERS - 1)) == 0, "SC_URING_BUFFERS must be a power of two");
+
+/* the low bits of user_data tell what completed, the rest is the connection (the pool is at least 8-byte aligned) */
+enum {
+    OP_ACCEPT = 1,
+    OP_RECV,
+    OP_SEND,
+    OP_POLL,
+    OP_CANCEL,
+    OP_ACCEPT_ONE,
+    OP_HANDOFF,
+};
+#define OP_MASK 7ULL
+
+#define BUFFER_GROUP 0
+
+/* One ring per loop. The listening socket has a multishot accept and every connection a multishot recv, which
+ * picks its buffers from a ring of provided ones; the data is copied into the connection read buffer, where the
+ * parser works as with epoll, and the buffer goes back at once. The responses go out with one send per connection
+ * at a time. Everything queued while handling a batch is submitted by the io_uring_enter() that waits for the next. */
+struct _sc_uring {
+    int fd;
+    bool disabled;          // created disabled, it is enabled by the thread running the loop
+
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_local_tail; // entries prepared, published to sq_tail when submitted
+
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    struct io_uring_buf_ring *buf_ring;
+    size_t buf_ring_size;
+    char *bufs;
+    unsigned short buf_tail;
+    int held_next[SC_URING_BUFFERS];    // buffers received but not copied yet, chained per connection
+    uint32_t held_off[SC_URING_BUFFERS];
+    uint32_t held_len[SC_URING_BUFFERS];
+
+    bool accept_armed;      // the multishot accept
+    int accepts;            // single accepts in flight, used instead while deferring clients
+    bool handoff_armed;     // polling the socket the old process passes its connections on
+    bool returned;          // buffers went back to the ring since the starved connections were last armed
+    sc_conn *starved;
+};
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+    return (int) syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+// submits what was prepared and waits for a completion up to timeout_ms (-1 forever, 0 not at all)
+static int uring_submit(struct _sc_uring *u, int timeout_ms) {
+    unsigned to_submit = u->sq_local_tail - *u->sq_tail;
+    __atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+
+    struct __kernel_timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000L};
+    struct io_uring_getevents_arg arg = {.ts = timeout_ms >= 0 ? (uint64_t) (uintptr_t) &ts : 0};
+    unsigned wait = timeout_ms != 0 ? 1 : 0;
+
+    // with deferred task running, completions are only posted while asking for them
+    int rc = uring_enter(u->fd, to_submit, wait, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    if (rc == -1 && errno != EINTR && errno != ETIME && errno != EBUSY && errno != EAGAIN) {
+        return SC_IO_URING_ERR;
+    }
+    return SC_OK;
+}
+
+// next free submission entry, submitting the ones before it if the queue is full
+static struct io_uring_sqe *uring_sqe(struct _sc_uring *u) {
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (u->sq_local_tail - head > u->sq_mask) {
+        uring_submit(u, 0);
+    }
+
+    unsigned index = u->sq_local_tail & u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[index] = index;
+    u->sq_local_tail++;
+    return sqe;
+}
+
+static uint64_t op_data(sc_conn *conn, int op) {
+    return (uint64_t) (uintptr_t) conn | op;
+}
+
+static void buffer_return(struct _sc_uring *u, int bid) {
+    struct io_uring_buf *buf = &u->buf_ring->bufs[u->buf_tail & (SC_URING_BUFFERS - 1)];
+    buf->addr = (uint64_t) (uintptr_t) (u->bufs + (size_t) bid * SC_URING_BUFFER_SIZE);
+    buf->len = SC_URING_BUFFER_SIZE;
+    buf->bid = bid;
+    u->buf_tail++;
+    __atomic_store_n(&u->buf_ring->tail, u->buf_tail, __ATOMIC_RELEASE);
+    u->returned = true;
+}
+
+static void ring_unmap(struct _sc_uring *u) {
+    if (u->sq_ring != NULL && u->sq_ring != MAP_FAILED) munmap(u->sq_ring, u->sq_ring_size);
+    if (u->cq_ring != NULL && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring) munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sqes != NULL && u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_size);
+    if (u->buf_ring != NULL && u->buf_ring != MAP_FAILED) munmap(u->buf_ring, u->buf_ring_size);
+    free(u->bufs);
+}
+
+static int ring_create(struct _sc_uring *u) {
+    // the ring is disabled until the loop thread enables it, so it can be its only submitter
+    const unsigned flag_sets[] = {
+        IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN
+            | IORING_SETUP_R_DISABLED,
+        IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN,
+        IORING_SETUP_CQSIZE,
+    };
+    struct io_uring_params params;
+    for (size_t i = 0; i < sizeof(flag_sets) / sizeof(flag_sets[0]); i++) {
+        memset(&params, 0, sizeof(params));
+        params.flags = flag_sets[i];
+        params.cq_entries = SC_URING_ENTRIES * 4;
+        u->fd = uring_setup(SC_URING_ENTRIES, &params);
+        if (u->fd >= 0 || errno != EINVAL) break;
+    }
+    if (u->fd < 0) return SC_IO_URING_ERR;
+    u->disabled = params.flags & IORING_SETUP_R_DISABLED;
+
+    const unsigned needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((params.features & needed) != needed) return SC_IO_URING_ERR;
+
+    u->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (u->cq_ring_size > u->sq_ring_size) {
+        u->sq_ring_size = u->cq_ring_size;
+    }
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    u->cq_ring = u->sq_ring;
+    u->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sq_ring == MAP_FAILED || u->sqes == MAP_FAILED) return SC_IO_URING_ERR;
+
+    char *sq = u->sq_ring;
+    u->sq_head = (unsigned *) (sq + params.sq_off.head);
+    u->sq_tail = (unsigned *) (sq + params.sq_off.tail);
+    u->sq_mask = *(unsigned *) (sq + params.sq_off.ring_mask);
+    u->sq_array = (unsigned *) (sq + params.sq_off.array);
+    u->sq_local_tail = *u->sq_tail;
+
+    char *cq = u->cq_ring;
+    u->cq_head = (unsigned *) (cq + params.cq_off.head);
+    u->cq_tail = (unsigned *) (cq + params.cq_off.tail);
+    u->cq_mask = *(unsigned *) (cq + params.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+    return SC_OK;
+}
+
+static int buffers_register(struct _sc_uring *u) {
+    u->buf_ring_size = SC_URING_BUFFERS * sizeof(struct io_uring_buf);
+    u->buf_ring = mmap(NULL, u->buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    u->bufs = malloc((size_t) SC_URING_BUFFERS * SC_URING_BUFFER_SIZE);
+    if (u->buf_ring == MAP_FAILED || u->bufs == NULL) return SC_MALLOC_ERR;
+
+    struct io_uring_buf_reg reg = {
+        .ring_addr = (uint64_t) (uintptr_t) u->buf_ring,
+        .ring_entries = SC_URING_BUFFERS,
+        .bgid = BUFFER_GROUP,
+    };
+    if (uring_register(u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1) return SC_IO_URING_ERR;
+
+    for (int bid = 0; bid < SC_URING_BUFFERS; bid++) {
+        buffer_return(u, bid);
+    }
+    return SC_OK;
+}
+
+int _sc_uring_init(sc_conn_mgr *mgr) {
+    struct _sc_uring *u = calloc(1, sizeof(struct _sc_uring));
+    if (u == NULL) return SC_MALLOC_ERR;
+    u->fd = -1;
+
+    int rc = ring_create(u);
+    if (rc == SC_OK) {
+        rc = buffers_register(u);
+    }
+    if (rc != SC_OK) {
+        sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Failed to set up io_uring");
+        ring_unmap(u);
+        if (u->fd >= 0) close(u->fd);
+        free(u);
+        return rc;
+    }
+
+    mgr->uring = u;
+    return SC_OK;
+}
+
+void _sc_uring_destroy(sc_conn_mgr *mgr) {
+    struct _sc_uring *u = mgr->uring;
+    if (u == NULL) return;
+
+    // closing the ring cancels what is still in flight
+    close(u->fd);
+    ring_unmap(u);
+    free(u);
+    mgr->uring = NULL;
+}
+
+static void accept_arm(sc_conn_mgr *mgr, bool multishot) {
+    struct io_uring_sqe *sqe = uring_sqe(mgr->uring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = mgr->fd;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    if (multishot) {
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->user_data = op_data(NULL, OP_ACCEPT);
+        mgr->uring->accept_armed = true;
+    } else {
+        sqe->user_data = op_data(NULL, OP_ACCEPT_ONE);
+        mgr->uring->accepts++;
+    }
+}
+
+// a multishot accept takes every client in the queue, so a deferring loop only asks for the ones it can admit
+static void accepts_arm(sc_conn_mgr *mgr) {
+    struct _sc_uring *u = mgr->uring;
+    if (mgr->lag_target_ns == 0 || mgr->shed_mode != SC_SHED_DEFER) {
+        if (!u->accept_armed) {
+            accept_arm(mgr, true);
+        }
+        return;
+    }
+    while (u->accepts < mgr->accept_budget && _sc_overload_admit(mgr, u->accepts)) {
+        accept_arm(mgr, false);
+    }
+}
+
+// cancels every operation with this user_data
+static void op_cancel(sc_conn_mgr *mgr, uint64_t data) {
+    struct io_uring_sqe *sqe = uring_sqe(mgr->uring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = data;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+    sqe->user_data = op_data(NULL, OP_CANCEL);
+}
+
+// matched by user_data rather than by fd, as the listening socket is closed right after
+void _sc_uring_unlisten(sc_conn_mgr *mgr) {
+    struct _sc_uring *u = mgr->uring;
+    if (u->accept_armed) {
+        op_cancel(mgr, op_data(NULL, OP_ACCEPT));
+    }
+    if (u->accepts > 0) {
+        op_cancel(mgr, op_data(NULL, OP_ACCEPT_ONE));
+    }
+}
+
+static void handoff_arm(sc_conn_mgr *mgr, int fd) {
+    struct io_uring_sqe *sqe = uring_sqe(mgr->uring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = op_data(NULL, OP_HANDOFF);
+    mgr->uring->handoff_armed = true;
+}
+
+static void recv_arm(sc_conn_mgr *mgr, sc_conn *conn) {
+    struct io_uring_sqe *sqe = uring_sqe(mgr->uring);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = op_data(conn, OP_RECV);
+    conn->uring.recv_armed = true;
+    conn->uring.ops++;
+}
+
+static void recv_cancel(sc_conn_mgr *mgr, sc_conn *conn) {
+    struct io_uring_sqe *sqe = uring_sqe(mgr->uring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = op_data(conn, OP_RECV);
+    sqe->user_data = op_data(NULL, OP_CANCEL);
+    conn->uring.recv_cancelling = true;
+}
+
+static void send_arm(sc_conn_mgr *mgr, sc_conn *conn) {
+    struct io_uring_sqe *sqe = uring_sqe(mgr->uring);
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t) (uintptr_t) (conn->uring.sbuf + conn->uring.sbuf_off);
+    sqe->len = conn->uring.sbuf_len - conn->uring.sbuf_off;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = op_data(conn, OP_SEND);
+    conn->uring.ops++;
+}
+
+static void poll_arm(sc_conn_mgr *mgr, sc_conn *conn) {
+    struct io_uring_sqe *sqe = uring_sqe(mgr->uring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = conn->fd;
+    sqe->poll32_events = POLLOUT;
+    sqe->user_data = op_data(conn, OP_POLL);
+    conn->uring.poll_armed = true;
+    conn->uring.ops++;
+}
+
+int _sc_uring_flush(sc_conn_mgr *mgr, sc_conn *conn) {
+    struct _sc_uring_conn *uc = &conn->uring;
+
+    // one send at a time, the next one goes out when it completed
+    if (uc->sbuf_off < uc->sbuf_len) {
+        return SC_PENDING;
+    }
+
+    if (conn->wbuf_off < conn->wbuf_len) {
+        // the queue is handed to the send as it is, and the connection keeps queueing into the other buffer
+        char *sbuf = uc->sbuf;
+        size_t sbuf_cap = uc->sbuf_cap;
+        uc->sbuf = conn->wbuf;
+        uc->sbuf_cap = conn->wbuf_cap;
+        uc->sbuf_off = conn->wbuf_off;
+        uc->sbuf_len = conn->wbuf_len;
+        conn->wbuf = sbuf;
+        conn->wbuf_cap = sbuf_cap;
+        conn->wbuf_off = 0;
+        conn->wbuf_len = 0;
+
+        send_arm(mgr, conn);
+        return SC_PENDING;
+    }
+
+    // a file body follows once its headers were sent, straight with sendfile(), polling if the socket is full
+    if (conn->file != NULL) {
+        int rc = _sc_file_send(conn);
+        if (rc == SC_SEND_ERR) {
+            sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Error sending file");
+        }
+        return rc;
+    }
+    return SC_OK;
+}
+
+void _sc_uring_update(sc_conn_mgr *mgr, sc_conn *conn, bool want_read, bool want_write) {
+    struct _sc_uring_conn *uc = &conn->uring;
+
+    // what was received is used up before anything more is
+    want_read = want_read && uc->held_head == -1 && !uc->eof && !uc->starved;
+    if (want_read && !uc->recv_armed) {
+        recv_arm(mgr, conn);
+    } else if (!want_read && uc->recv_armed && !uc->recv_cancelling && !uc->starved) {
+        recv_cancel(mgr, conn);
+    }
+
+    // the completion of a send is what the next output waits for, the socket is only polled without one
+    if (want_write && uc->sbuf_off == uc->sbuf_len && !uc->poll_armed) {
+        poll_arm(mgr, conn);
+    }
+}
+
+static void release(sc_conn_mgr *mgr, sc_conn *conn) {
+    struct _sc_uring *u = mgr->uring;
+    struct _sc_uring_conn *uc = &conn->uring;
+
+    while (uc->held_head != -1) {
+        int bid = uc->held_head;
+        uc->held_head = u->held_next[bid];
+        buffer_return(u, bid);
+    }
+    if (uc->handoff) {
+        _sc_handoff_send(mgr, conn->fd);
+        uc->handoff = false;
+    }
+    if (uc->starved) {
+        sc_conn **link = &u->starved;
+        while (*link != conn) link = &(*link)->uring.starved_next;
+        *link = uc->starved_next;
+    }
+
+    close(conn->fd);
+    uc->active = false;
+    uc->sbuf_off = 0;
+    uc->sbuf_len = 0;
+    sc_mgr_conn_release(mgr, conn);
+}
+
+void _sc_uring_close(sc_conn_mgr *mgr, sc_conn *conn) {
+    struct _sc_uring_conn *uc = &conn->uring;
+    if (uc->closed) return;
+
+    uc->closed = true;
+    conn->closing = true;
+    _sc_timer_del(&conn->timer);
+
+    // the shutdown completes the recv, send and poll still in flight, then the connection can be reused
+    if (uc->ops > 0) {
+        shutdown(conn->fd, SHUT_RDWR);
+        return;
+    }
+    release(mgr, conn);
+}
+
+void _sc_uring_hand_off(sc_conn_mgr *mgr, sc_conn *conn) {
+    struct _sc_uring_conn *uc = &conn->uring;
+    if (uc->closed) return;
+
+    uc->closed = true;
+    uc->handoff = true;
+    conn->closing = true;
+    _sc_timer_del(&conn->timer);
+
+    // unlike a close there is no shutdown, the socket lives on in the new process, only the recv is cancelled
+    if (uc->recv_armed && !uc->recv_cancelling) {
+        recv_cancel(mgr, conn);
+    }
+    if (uc->ops == 0) {
+        release(mgr, conn);
+    }
+}
+
+// an operation of a closed connection completed
+static void closed_op_done(sc_conn_mgr *mgr, sc_conn *conn) {
+    if (conn->uring.ops == 0) {
+        release(mgr, conn);
+    }
+}
+
+static void conn_open(sc_conn_mgr *mgr, int fd) {
+    bool full = mgr->conn_count >= mgr->max_conn_count;
+    if (full || (mgr->shed_mode == SC_SHED_REJECT && !_sc_overload_admit(mgr, 0))) {
+        if (full) {
+            sc_error_log(mgr, SC_LL_NORMAL, "[Sculpt] No avaliable connections found! Sending 503 response\n");
+            _SC_STAT_ADD(mgr->stats.rejected, 1);
+        } else {
+            _SC_STAT_ADD(mgr->stats.shed, 1);
+        }
+        send(fd, mgr->response_503.buf, mgr->response_503.len, MSG_NOSIGNAL);
+        close(fd);
+        return;
+    }
+
+    sc_conn *conn = sc_mgr_conn_get_free(mgr);
+    if (conn == NULL) {
+        sc_error_log(mgr, SC_LL_NORMAL, "[Sculpt] Failed to find free connection on sc_mgr_conn_get_free()\n");
+        close(fd);
+        return;
+    }
+    conn->fd = fd;
+    sc_log(mgr, SC_LL_DEBUG, "[Sculpt] Created new connection\n");
+    _SC_STAT_ADD(mgr->stats.accepted, 1);
+    mgr->admitted++;
+
+    // a multishot accept has no address to give, it is only asked for when it is logged
+    if (mgr->access_log != NULL) {
+        socklen_t peer_len = sizeof(conn->peer);
+        getpeername(fd, (struct sockaddr *) &conn->peer, &peer_len);
+    }
+    _sc_uring_open(mgr, conn);
+}
+
+void _sc_uring_open(sc_conn_mgr *mgr, sc_conn *conn) {
+    struct _sc_uring_conn *uc = &conn->uring;
+    uc->active = true;
+    uc->closed = false;
+    uc->recv_armed = false;
+    uc->recv_cancelling = false;
+    uc->poll_armed = false;
+    uc->eof = false;
+    uc->ops = 0;
+    uc->held_head = -1;
+    uc->held_tail = -1;
+    uc->sbuf_off = 0;
+    uc->sbuf_len = 0;
+    uc->starved = false;
+    uc->handoff = false;
+    recv_arm(mgr, conn);
+}
+
+// copies what was received into the read buffer, as far as it fits
+static void held_fill(struct _sc_uring *u, sc_conn *conn) {
+    struct _sc_uring_conn *uc = &conn->uring;
+
+    while (uc->held_head != -1 && conn->rbuf_len < conn->rbuf_cap) {
+        int bid = uc->held_head;
+        size_t n = u->held_len[bid] - u->held_off[bid];
+        if (n > conn->rbuf_cap - conn->rbuf_len) {
+            n = conn->rbuf_cap - conn->rbuf_len;
+        }
+        memcpy(conn->rbuf + conn->rbuf_len, u->bufs + (size_t) bid * SC_URING_BUFFER_SIZE + u->held_off[bid], n);
+        conn->rbuf_len += n;
+        u->held_off[bid] += n;
+
+        if (u->held_off[bid] == u->held_len[bid]) {
+            uc->held_head = u->held_next[bid];
+            if (uc->held_head == -1) {
+                uc->held_tail = -1;
+            }
+            buffer_return(u, bid);
+        }
+    }
+
+    if (uc->held_head == -1 && uc->eof) {
+        conn->read_closed = true;
+    }
+}
+
+static bool conn_alive(sc_conn *conn) {
+    return conn->state == CONN_ACTIVE && !conn->uring.closed;
+}
+
+// serves the connection until it can't take in more of what it received: every round either copies something
+// or stops with a full read buffer
+static void conn_serve(sc_conn_mgr *mgr, sc_conn *conn) {
+    for (;;) {
+        held_fill(mgr->uring, conn);
+        _sc_conn_serve(mgr, conn);
+        if (!conn_alive(conn) || conn->uring.held_head == -1 || conn->rbuf_len == conn->rbuf_cap) return;
+    }
+}
+
+static void recv_done(sc_conn_mgr *mgr, sc_conn *conn, int res, unsigned flags) {
+    struct _sc_uring *u = mgr->uring;
+    struct _sc_uring_conn *uc = &conn->uring;
+
+    if (!(flags & IORING_CQE_F_MORE)) {
+        uc->recv_armed = false;
+        uc->recv_cancelling = false;
+        uc->ops--;
+    }
+
+    if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+        int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (uc->closed) {
+            // a request that came in while it was being handed over is lost, the client is better off with a close
+            uc->handoff = false;
+            buffer_return(u, bid);
+        } else {
+            u->held_off[bid] = 0;
+            u->held_len[bid] = res;
+            u->held_next[bid] = -1;
+            if (uc->held_tail != -1) {
+                u->held_next[uc->held_tail] = bid;
+            } else {
+                uc->held_head = bid;
+            }
+            uc->held_tail = bid;
+        }
+    }
+
+    if (uc->closed) {
+        closed_op_done(mgr, conn);
+        return;
+    }
+
+    if (res == 0) {
+        // EOF, client closed the connection
+        uc->eof = true;
+    } else if (res == -ENOBUFS) {
+        // every buffer is held by connections that can't take more yet
+        if (!uc->starved) {
+            uc->starved = true;
+            uc->starved_next = u->starved;
+            u->starved = conn;
+        }
+        return;
+    } else if (res < 0 && res != -ECANCELED) {
+        errno = -res;
+        sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Error reading request from client");
+        _sc_uring_close(mgr, conn);
+        return;
+    }
+
+    conn->last_active = mgr->now;
+    conn_serve(mgr, conn);
+}
+
+static void send_done(sc_conn_mgr *mgr, sc_conn *conn, int res) {
+    struct _sc_uring_conn *uc = &conn->uring;
+    uc->ops--;
+
+    if (uc->closed) {
+        closed_op_done(mgr, conn);
+        return;
+    }
+    if (res < 0) {
+        errno = -res;
+        sc_perror(mgr, SC_LL_NORMAL, "[Sculpt] Error sending response");
+        _sc_uring_close(mgr, conn);
+        return;
+    }
+
+    uc->sbuf_off += res;
+    if (uc->sbuf_off < uc->sbuf_len) {
+        send_arm(mgr, conn);
+        return;
+    }
+    uc->sbuf_off = 0;
+    uc->sbuf_len = 0;
+
+    conn->last_active = mgr->now;
+    conn_serve(mgr, conn);
+}
+
+static void poll_done(sc_conn_mgr *mgr, sc_conn *conn) {
+    conn->uring.poll_armed = false;
+    conn->uring.ops--;
+
+    if (conn->uring.closed) {
+        closed_op_done(mgr, conn);
+        return;
+    }
+    conn->last_active = mgr->now;
+    conn_serve(mgr, conn);
+}
+
+static void accept_done(sc_conn_mgr *mgr, int res, unsigned flags, bool multishot) {
+    if (!multishot) {
+        mgr->uring->accepts--;
+    } else if (!(flags & IORING_CQE_F_MORE)) {
+        mgr->uring->accept_armed = false;
+    }
+    if (res >= 0) {
+        conn_open(mgr, res);
+    } else if (res != -ECANCELED && res != -EINTR && res != -ECONNABORTED && res != -EPROTO) {
+        sc_error_log(mgr, SC_LL_MINIMAL, "[Sculpt] Fatal: Accept error: %d\n", -res);
+    }
+}
+
+// connections whose recv ran out of buffers try again once some came back
+static void starved_rearm(sc_conn_mgr *mgr) {
+    struct _sc_uring *u = mgr->uring;
+    if (u->starved == NULL || !u->returned) return;
+
+    sc_conn *conn = u->starved;
+    u->starved = NULL;
+    while (conn != NULL) {
+        sc_conn *next = conn->uring.starved_next;
+        conn->uring.starved = false;
+        conn_serve(mgr, conn);
+        conn = next;
+    }
+}
+
+int _sc_uring_poll(sc_conn_mgr *mgr, int timeout_ms) {
+    struct _sc_uring *u = mgr->uring;
+
+    if (u->disabled) {
+        if (uring_register(u->fd, IORING_REGISTER_ENABLE_RINGS, NULL, 0) == -1) {
+            sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Failed to enable io_uring");
+            return SC_IO_URING_ERR;
+        }
+        u->disabled = false;
+    }
+    if (mgr->listening) {
+        accepts_arm(mgr);
+    }
+    int prev_fd = _sc_handoff_prev_fd(mgr);
+    if (prev_fd >= 0 && !u->handoff_armed) {
+        handoff_arm(mgr, prev_fd);
+    }
+    timeout_ms = _sc_overload_timeout(mgr, timeout_ms);
+
+    // completions left from the last batch are handled right away
+    unsigned head = *u->cq_head;
+    if (head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) {
+        timeout_ms = 0;
+    }
+    if (uring_submit(u, timeout_ms) != SC_OK) {
+        sc_perror(mgr, SC_LL_MINIMAL, "[Sculpt] Error on io_uring_enter");
+        return SC_IO_URING_ERR;
+    }
+    mgr->now = _sc_clock_now();
+    uint64_t start_ns = _sc_overload_begin(mgr);
+    u->returned = false;
+
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    unsigned count = tail - head;
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+        uint64_t data = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        sc_conn *conn = (sc_conn *) (uintptr_t) (data & ~OP_MASK);
+        switch (data & OP_MASK) {
+            case OP_ACCEPT: accept_done(mgr, res, flags, true); break;
+            case OP_ACCEPT_ONE: accept_done(mgr, res, flags, false); break;
+            case OP_RECV: recv_done(mgr, conn, res, flags); break;
+            case OP_SEND: send_done(mgr, conn, res); break;
+            case OP_POLL: poll_done(mgr, conn); break;
+            case OP_HANDOFF:
+                u->handoff_armed = false;
+                _sc_handoff_receive(mgr);
+                break;
+            default: break;
+        }
+    }
+
+    if (count > 0) {
+        _SC_STAT_ADD(mgr->stats.polls, 1);
+        _SC_STAT_ADD(mgr->stats.events, count);
+        __atomic_store_n(&mgr->stats.last_batch, count, __ATOMIC_RELAXED);
+    }
+    starved_rearm(mgr);
+
+    sc_mgr_conns_cleanup(mgr);
+    // completions that came in meanwhile are handled by the next call, without waiting
+    _sc_overload_update(mgr, start_ns, count, head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE));
+    return SC_OK;
+}
+
+#else
+
+// built without io_uring, no loop ever has a ring
+
+int _sc_uring_init(sc_conn_mgr *mgr) {
+    (void) mgr;
+    return SC_IO_URING_ERR;
+}
+
+void _sc_uring_destroy(sc_conn_mgr *mgr) {
+    (void) mgr;
+}
+
+int _sc_uring_poll(sc_conn_mgr *mgr, int timeout_ms) {
+    (void) mgr;
+    (void) timeout_ms;
+    return SC_IO_URING_ERR;
+}
+
+int _sc_uring_flush(sc_conn_mgr *mgr, sc_conn *conn) {
+    (void) mgr;
+    (void) conn;
+    return SC_SEND_ERR;
+}
+
+void _sc_uring_update(sc_conn_mgr *mgr, sc_conn *conn, bool want_read, bool want_write) {
+    (void) mgr;
+    (void) conn;
+    (void) want_read;
+    (void) want_write;
+}
+
+void _sc_uring_close(sc_conn_mgr *mgr, sc_conn *conn) {
+    (void) mgr;
+    (void) conn;
+}
+
+void _sc_uring_open(sc_conn_mgr *mgr, sc_conn *conn) {
+    (void) mgr;
+    (void) conn;
+}
+
+void _sc_uring_hand_off(sc_conn_mgr *mgr, sc_conn *conn) {
+    (void) mgr;
+    (void) conn;
+}
+
+void _sc_uring_unlisten(sc_conn_mgr *mgr) {
+    (void) mgr;
+}
+
+#endif
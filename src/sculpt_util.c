@@ -2,7 +2,8 @@
 #include <string.h>
 #include <stddef.h>
 #include <stdbool.h>
-#include <stdarg.h>
+#include <errno.h>
+#include <sys/uio.h>
 
 #include "sculpt.h"
 
@@ -11,33 +12,24 @@ const char *http_template = "HTTP/1.1 %d %s\r\n"
     "Content-Length: %zu\r\n"
     "Connection: keep-alive\r\n";
 
-// logging
-void sc_log(sc_conn_mgr *mgr, int ll, const char *format, ...) {
-    // only log if the current log level (ll) is equal or higher than the requested one (level)
-    // exapmle: ll = SC_LL_NORMAL (2), level = SC_LL_MINIMAL (1) -> we log;
-    // ll = SC_LL_MINIMAL (1), level = SC_LL_NORMAL (2) -> we DON'T log;
-    if (ll == SC_LL_NONE || ll < mgr->ll) return;
-
-    va_list args;
-    va_start(args, format);
-    vprintf(format, args);
-    va_end(args);
-}
-
-void sc_error_log(sc_conn_mgr *mgr, int ll, const char *format, ...) {
-    if (ll == SC_LL_NONE || ll < mgr->ll) return;
+// status line of the responses after which the server closes the connection
+static const char *http_template_close = "HTTP/1.1 %d %s\r\n"
+    "Content-Length: %zu\r\n"
+    "Connection: close\r\n";
 
-    va_list args;
-    va_start(args, format);
-    vfprintf(stderr, format, args);
-    va_end(args);
-}
+// status line of streamed responses, whose length isn't known when they start
+static const char *http_template_chunked = "HTTP/1.1 %d %s\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Connection: keep-alive\r\n";
 
-void sc_perror(sc_conn_mgr *mgr, int ll, const char *err) {
-    if (ll == SC_LL_NONE || ll < mgr->ll) return;
+static const char *http_template_chunked_close = "HTTP/1.1 %d %s\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Connection: close\r\n";
 
-    perror(err);
-}
+// status line of streamed responses to HTTP/1.0 clients, which don't know chunked encoding. Closing the connection
+// ends the body
+static const char *http_template_stream_close = "HTTP/1.1 %d %s\r\n"
+    "Connection: close\r\n";
 
 sc_str sc_str_ref(const char *str) {
     sc_str sc_str = {(char *) str, str == NULL ? 0 : strlen(str)};
@@ -89,59 +81,282 @@ bool sc_strprefix(const sc_str str, const sc_str prefix) {
     return memcmp(str.buf, prefix.buf, prefix.len) == 0;
 }
 
+bool sc_strsuffix(const sc_str str, const sc_str suffix) {
+    if (str.len < suffix.len) {
+        return false;
+    }
+
+    return memcmp(str.buf + str.len - suffix.len, suffix.buf, suffix.len) == 0;
+}
+
+static const char crlf[] = "\r\n";
+
+// adds a header line to the iovec array. Lines without the trailing \r\n (like request headers) get it as a separate entry
+static int iov_push_line(struct iovec *iov, int n, int cap, const char *line, size_t len) {
+    if (n >= cap) return -1;
+    iov[n++] = (struct iovec) {(void *) line, len};
+
+    if (len < 2 || line[len - 2] != '\r' || line[len - 1] != '\n') {
+        if (n >= cap) return -1;
+        iov[n++] = (struct iovec) {(void *) crlf, 2};
+    }
+    return n;
+}
+
+// describes a full response as iovecs pointing at the caller's data. Only the status line is formatted, into head,
+// from one of the templates above. returns the number of iovecs used, or -1 if there are more headers than fit in iov
+static int response_iov_build(struct iovec *iov, int cap, char *head, size_t head_size, const char *template, int code,
+                              const char *code_str, const char *content_type, sc_headers *headers, const char *body,
+                              size_t body_len) {
+    int head_len = snprintf(head, head_size, template, code, code_str, body_len);
+    if (head_len < 0 || (size_t) head_len >= head_size) return -1;
+
+    int n = 0;
+    iov[n++] = (struct iovec) {head, head_len};
+    if (content_type != NULL) {
+        n = iov_push_line(iov, n, cap, content_type, strlen(content_type));
+    }
+
+    for (sc_headers *current = headers; current != NULL && n >= 0; current = current->next) {
+        n = iov_push_line(iov, n, cap, current->header.buf, current->header.len);
+    }
+    if (n < 0 || n + 2 > cap) return -1;
+
+    iov[n++] = (struct iovec) {(void *) crlf, 2};
+    if (body_len > 0) {
+        iov[n++] = (struct iovec) {(void *) body, body_len};
+    }
+    return n;
+}
+
+// upper bound of the iovecs needed for a response: status line, content type, headers (each with its own \r\n),
+// blank line and body. Responses with many headers get a heap array instead of the stack one
+static int response_iov_count(sc_headers *headers) {
+    int cap = 5;
+    for (sc_headers *current = headers; current != NULL; current = current->next) {
+        cap += 2;
+    }
+    return cap > SC_EASY_IOV_COUNT ? cap : SC_EASY_IOV_COUNT;
+}
+
+static size_t iov_total(const struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    return total;
+}
+
+// writes the whole iovec array to a socket that isn't served by the loop, retrying short writes. A reset peer
+// gets an error instead of SIGPIPE
+static int writev_all(int fd, struct iovec *iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = sendmsg(fd, &(struct msghdr) {.msg_iov = iov, .msg_iovlen = iovcnt}, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return SC_SEND_ERR;
+        }
+
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return SC_OK;
+}
+
+int _sc_response_serialize(sc_str *out, int code, const char *code_str, const char *content_type,
+                           const char *body, size_t body_len, sc_headers *headers, bool keep_alive) {
+    struct iovec iov_buf[SC_EASY_IOV_COUNT];
+    struct iovec *iov = iov_buf;
+    char head[SC_EASY_HEAD_SIZE];
+
+    int cap = response_iov_count(headers);
+    if (cap > SC_EASY_IOV_COUNT) {
+        iov = malloc(cap * sizeof(struct iovec));
+        if (iov == NULL) {
+            return SC_MALLOC_ERR;
+        }
+    }
+
+    int rc = SC_BUFFER_OVERFLOW_ERR;
+    const char *template = keep_alive ? http_template : http_template_close;
+    int iovcnt = response_iov_build(iov, cap, head, sizeof(head), template, code, code_str, content_type, headers, body, body_len);
+    if (iovcnt >= 0) {
+        size_t len = iov_total(iov, iovcnt);
+        char *response = malloc(len + 1);
+        rc = SC_MALLOC_ERR;
+
+        if (response != NULL) {
+            char *end = response;
+            for (int i = 0; i < iovcnt; i++) {
+                memcpy(end, iov[i].iov_base, iov[i].iov_len);
+                end += iov[i].iov_len;
+            }
+            *end = '\0';
+            *out = sc_str_ref_n(response, len);
+            rc = SC_OK;
+        }
+    }
+
+    if (iov != iov_buf) {
+        free(iov);
+    }
+    return rc;
+}
+
+// inside a handler, the response goes through the connection so it stays ordered with the other responses of the
+// same event. Other sockets are written to right away
+static int response_write(int fd, struct iovec *iov, int iovcnt) {
+    sc_conn *conn = _sc_conn_current(fd);
+    if (conn != NULL) {
+        return _sc_conn_writev(conn, iov, iovcnt);
+    }
+    return writev_all(fd, iov, iovcnt);
+}
+
 char *sc_easy_request_build(int code, const char *code_str, const char *body, sc_headers *headers) {
-    char *request;
-    size_t response_len = strlen(http_template) + strlen(code_str) + 3 + 16 + 4; 
-    // 3 for the response code (200, 404, 403, etc), 16 for the content-length and 4 for the \r\n\r\n
-    
-    sc_headers *current = headers;
-    while (current) {
-        // assuming the header_len includes the \r\n, as it should
-        response_len += current->header.len + 1; 
-        current = current->next;
-    }
-
-    size_t body_len = strlen(body);
-    response_len += body_len;
-
-    char *response = malloc(response_len + 1);
-    
-    if (response == NULL) {
+    sc_str response;
+    if (_sc_response_serialize(&response, code, code_str, NULL, body, strlen(body), headers, true) != SC_OK) {
         return NULL;
     }
+    return response.buf;
+}
+
+// the Connection header has to tell whether the connection is closed after the response, which the request decides
+static const char *response_template(const sc_conn *conn) {
+    return conn != NULL && !_sc_conn_keep_alive(conn) ? http_template_close : http_template;
+}
 
-    snprintf(response, response_len, http_template, 
-            code, code_str, body_len
-    );
+int sc_easy_send_n(int fd, int code, const char *code_str, const char *content_type, const char *body, size_t body_len, sc_headers *headers) {
+    sc_conn *conn = _sc_conn_current(fd);
+    struct iovec iov_buf[SC_EASY_IOV_COUNT];
+    struct iovec *iov = iov_buf;
+    char head[SC_EASY_HEAD_SIZE];
+
+    int cap = response_iov_count(headers);
+    if (cap > SC_EASY_IOV_COUNT) {
+        iov = malloc(cap * sizeof(struct iovec));
+        if (iov == NULL) {
+            sc_headers_free(headers);
+            return SC_MALLOC_ERR;
+        }
+    }
 
-    current = headers;
-    while (current) {
-        // assuming the header ends with \r\n, as it should
-        strncat(response, current->header.buf, current->header.len);
-        current = current->next;
+    int rc = SC_BUFFER_OVERFLOW_ERR;
+    int iovcnt = response_iov_build(iov, cap, head, sizeof(head), response_template(conn), code, code_str, content_type, headers, body, body_len);
+    if (iovcnt >= 0) {
+        rc = response_write(fd, iov, iovcnt);
     }
 
-    strcat(response, "\r\n");
-    strncat(response, body, body_len);
+    if (rc == SC_OK && conn != NULL) {
+        conn->access.status = code;
+    }
+
+    if (iov != iov_buf) {
+        free(iov);
+    }
+    sc_headers_free(headers);
 
-    return response;
+    return rc;
 }
 
 int sc_easy_send(int fd, int code, const char *code_str, const char *content_type, const char *body, sc_headers *headers) {
+    return sc_easy_send_n(fd, code, code_str, content_type, body, strlen(body), headers);
+}
 
-    headers = sc_header_append(content_type, headers);
-    char *response = sc_easy_request_build(code, code_str, body, headers);
+int sc_stream_begin(int fd, int code, const char *code_str, const char *content_type, sc_headers *headers) {
+    sc_conn *conn = _sc_conn_current(fd);
+    bool raw = conn != NULL && !conn->parser.http11;
+    struct iovec iov_buf[SC_EASY_IOV_COUNT];
+    struct iovec *iov = iov_buf;
+    char head[SC_EASY_HEAD_SIZE];
 
-    if (headers == NULL) {
-        return SC_MALLOC_ERR;
+    int cap = response_iov_count(headers);
+    if (cap > SC_EASY_IOV_COUNT) {
+        iov = malloc(cap * sizeof(struct iovec));
+        if (iov == NULL) {
+            sc_headers_free(headers);
+            return SC_MALLOC_ERR;
+        }
     }
 
-    if (send(fd, response, strlen(response), 0) == -1) {
-       return SC_SEND_ERR;
+    int rc = SC_BUFFER_OVERFLOW_ERR;
+    const char *template = http_template_chunked;
+    if (raw) {
+        template = http_template_stream_close;
+    } else if (conn != NULL && !_sc_conn_keep_alive(conn)) {
+        template = http_template_chunked_close;
+    }
+    int iovcnt = response_iov_build(iov, cap, head, sizeof(head), template, code, code_str, content_type, headers, NULL, 0);
+    if (iovcnt >= 0) {
+        rc = response_write(fd, iov, iovcnt);
     }
 
-    free(response);
+    if (rc == SC_OK && conn != NULL) {
+        conn->streaming = true;
+        conn->stream_raw = raw;
+        conn->access.status = code;
+        if (raw) {
+            // the connection is closed once this request is done, which is how the client sees the body end
+            conn->parser.keep_alive = false;
+        }
+    }
+
+    if (iov != iov_buf) {
+        free(iov);
+    }
     sc_headers_free(headers);
 
+    return rc;
+}
+
+int sc_stream_chunk(int fd, const char *data, size_t len) {
+    // an empty chunk would end the response
+    if (len == 0) return SC_OK;
+
+    sc_conn *conn = _sc_conn_current(fd);
+    if (conn != NULL && conn->stream_raw) {
+        struct iovec iov = {(void *) data, len};
+        return response_write(fd, &iov, 1);
+    }
+
+    char size[24];
+    int size_len = snprintf(size, sizeof(size), "%zx\r\n", len);
+    struct iovec iov[3] = {
+        {size, size_len},
+        {(void *) data, len},
+        {(void *) crlf, 2}
+    };
+    return response_write(fd, iov, 3);
+}
+
+int sc_stream_end(int fd) {
+    static const char last_chunk[] = "0\r\n\r\n";
+    struct iovec iov = {(void *) last_chunk, sizeof(last_chunk) - 1};
+
+    sc_conn *conn = _sc_conn_current(fd);
+    bool raw = conn != NULL && conn->stream_raw;
+    if (conn != NULL) {
+        conn->streaming = false;
+        conn->stream_raw = false;
+    }
+    // an unframed body has no end marker, the connection close ends it
+    return raw ? SC_OK : response_write(fd, &iov, 1);
+}
+
+int sc_stream_produce(int fd, int (*producer)(int, void *), void *ctx) {
+    sc_conn *conn = _sc_conn_current(fd);
+    if (conn == NULL || producer == NULL || !conn->streaming || conn->producer != NULL) {
+        return SC_BAD_ARGUMENTS_ERR;
+    }
+
+    conn->producer = producer;
+    conn->producer_ctx = ctx;
     return SC_OK;
 }
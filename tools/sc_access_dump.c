@@ -0,0 +1,127 @@
+/* Converts sculpt access log files (see sc_mgr_access_log_enable()) to text, one line per request:
+ *
+ *     2026-01-31T12:00:00.123456Z 127.0.0.1:51234 GET /index.html 200 1532 parse=12us handler=40us send=8us
+ *
+ * usage: sc_access_dump <file>... */
+
+#include "../src/sculpt.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const uint8_t v4_mapped[12] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff};
+
+static void print_addr(const sc_access_entry *entry) {
+    char buf[INET6_ADDRSTRLEN];
+    if (memcmp(entry->addr, v4_mapped, sizeof(v4_mapped)) == 0) {
+        inet_ntop(AF_INET, &entry->addr[12], buf, sizeof(buf));
+        printf("%s:%u", buf, entry->port);
+    } else {
+        inet_ntop(AF_INET6, entry->addr, buf, sizeof(buf));
+        printf("[%s]:%u", buf, entry->port);
+    }
+}
+
+static void print_us(const char *name, uint32_t us) {
+    if (us == UINT32_MAX) {
+        printf(" %s=-", name);
+    } else {
+        printf(" %s=%uus", name, us);
+    }
+}
+
+static void print_entry(const char *map, size_t size, const sc_access_entry *entry) {
+    time_t sec = entry->time / 1000000000u;
+    struct tm tm;
+    char date[32];
+    gmtime_r(&sec, &tm);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &tm);
+    printf("%s.%06uZ ", date, (unsigned) (entry->time % 1000000000u / 1000));
+
+    print_addr(entry);
+    if (entry->method[0] != '\0') {
+        printf(" %.*s ", (int) strnlen(entry->method, sizeof(entry->method)), entry->method);
+    } else {
+        printf(" - ");
+    }
+
+    uint16_t len;
+    if (entry->uri_off != 0 && entry->uri_off + sizeof(len) <= size) {
+        memcpy(&len, map + entry->uri_off, sizeof(len));
+        if (entry->uri_off + sizeof(len) + len <= size) {
+            fwrite(map + entry->uri_off + sizeof(len), 1, len, stdout);
+        }
+    } else {
+        printf("-");
+    }
+
+    printf(" %u %llu", entry->status, (unsigned long long) entry->bytes);
+    print_us("parse", entry->parse_us);
+    print_us("handler", entry->handler_us);
+    print_us("send", entry->send_us);
+    printf("\n");
+}
+
+static int dump(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        perror(path);
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(sc_access_log_header)) {
+        fprintf(stderr, "%s: not an access log\n", path);
+        close(fd);
+        return 1;
+    }
+    size_t size = st.st_size;
+
+    const char *map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror(path);
+        return 1;
+    }
+
+    const sc_access_log_header *header = (const sc_access_log_header *) map;
+    if (header->magic != SC_ACCESS_LOG_MAGIC || header->version != SC_ACCESS_LOG_VERSION
+        || header->entry_size != sizeof(sc_access_entry)) {
+        fprintf(stderr, "%s: not an access log, or written by another version\n", path);
+        munmap((void *) map, size);
+        return 1;
+    }
+
+    // the server may still be writing it, only the entries counted in the header are complete
+    size_t count = __atomic_load_n(&header->entry_count, __ATOMIC_ACQUIRE);
+    size_t max = (size - sizeof(sc_access_log_header)) / sizeof(sc_access_entry);
+    if (count > max) {
+        count = max;
+    }
+
+    const sc_access_entry *entries = (const sc_access_entry *) (map + sizeof(sc_access_log_header));
+    for (size_t i = 0; i < count; i++) {
+        print_entry(map, size, &entries[i]);
+    }
+
+    munmap((void *) map, size);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <access log>...\n", argv[0]);
+        return 2;
+    }
+
+    int rc = 0;
+    for (int i = 1; i < argc; i++) {
+        rc |= dump(argv[i]);
+    }
+    return rc;
+}